@@ -0,0 +1,44 @@
+#ifndef FEATUREDETECTION_H
+#define FEATUREDETECTION_H
+
+#include "linde.h"
+#include "TensorField.h"
+
+namespace linde
+{
+
+// corner features from the structure tensor, no gradients are recomputed.
+// Shi, Tomasi: Good features to track (minimum eigenvalue)
+// Harris, Stephens: A combined corner and edge detector (det - k * trace^2)
+
+struct Feature
+{
+    glm::vec2   position;
+    float       response;
+};
+
+enum CornerResponse
+{
+    CORNER_MIN_EIGENVALUE,
+    CORNER_HARRIS
+};
+
+// response maps of both detectors in a single pass over the tensors, empty outputs are skipped
+void cornerResponses(const StructureTensorField & tensors, cv::Mat_<float> * minEigenvalue, cv::Mat_<float> * harris, float k = 0.04f);
+
+void cornerResponse(const StructureTensorField & tensors, cv::Mat_<float> & response, CornerResponse type, float k = 0.04f);
+
+// marks pixels which are the maximum of their (2 * radius + 1)^2 neighborhood and above threshold
+void nonMaximumSuppression(const cv::Mat_<float> & response, cv::Mat_<uchar> & maxima, int radius, float threshold);
+
+// strongest local maxima with response >= qualityLevel * max response, at least minDistance apart, at most maxFeatures (0 = all).
+// sorted by descending response
+std::vector<Feature> selectFeatures(const cv::Mat_<float> & response, int maxFeatures, float qualityLevel = 0.01f,
+                                    float minDistance = 5.f, int nmsRadius = 1);
+
+std::vector<Feature> detectFeatures(const StructureTensorField & tensors, CornerResponse type, int maxFeatures,
+                                    float qualityLevel = 0.01f, float minDistance = 5.f, float k = 0.04f);
+
+} // namespace linde
+
+#endif // FEATUREDETECTION_H
@@ -0,0 +1,65 @@
+#ifndef FLOWDOG_H
+#define FLOWDOG_H
+
+#include "linde.h"
+#include "TensorField.h"
+
+namespace linde
+{
+
+// Kang, Henry Lee, Seungyong Chui, Charles K.
+// Coherent Line Drawing
+// http://dl.acm.org/citation.cfm?id=1274878
+//
+// flow-based difference of gaussians: a 1D DoG across the flow (gradient direction) followed by a
+// gaussian along the streamlines of the tensor field (tangent direction).
+// the streamlines are traced once per field and shared by all filter calls and iterations.
+class FlowDoG
+{
+public:
+    FlowDoG();
+    ~FlowDoG();
+
+    // traces the streamlines of the field with sigmaM (smoothing along the flow, must be positive)
+    void setTensorField(const StructureTensorField & tensors, float sigmaM = 3.f);
+
+    // luminance in [0, 1], result is 0 on lines and 1 elsewhere.
+    // every further iteration superimposes the lines on the input and filters again
+    void filter(const cv::Mat_<float> & luminance, cv::Mat_<float> & result, int iterations = 1) const;
+
+    // the flow-based DoG response before thresholding
+    void filterResponse(const cv::Mat_<float> & luminance, cv::Mat_<float> & response) const;
+
+    // scale of the DoG center, the surround is 1.6 * sigmaC. non-positive values are rejected
+    float getSigmaC() const;
+    void setSigmaC(float sigmaC);
+
+    // weight of the surround gaussian (noise level), typically 0.97 ... 0.99
+    float getRho() const;
+    void setRho(float rho);
+
+    // threshold of the line response
+    float getTau() const;
+    void setTau(float tau);
+
+    float getSigmaM() const;
+
+private:
+    float                       m_sigmaC;
+    float                       m_rho;
+    float                       m_tau;
+    float                       m_sigmaM;
+
+    int                         m_rows;
+    int                         m_cols;
+    int                         m_streamlineLength;     // samples per direction
+    cv::Mat_<glm::vec2>         m_gradient;             // normalized gradient direction per pixel
+    cv::Mat_<cv::Vec2s>         m_streamlines;          // per pixel row: forward then backward sample offsets (1/64 px)
+
+    void gradientDoG(const cv::Mat_<float> & luminance, cv::Mat_<float> & response) const;
+    void flowSmoothing(const cv::Mat_<float> & response, cv::Mat_<float> & smoothed) const;
+};
+
+} // namespace linde
+
+#endif // FLOWDOG_H
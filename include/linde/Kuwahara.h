@@ -0,0 +1,73 @@
+#ifndef KUWAHARA_H
+#define KUWAHARA_H
+
+#include "linde.h"
+#include "TensorField.h"
+
+namespace linde
+{
+
+// Kyprianidis, JE Kang, Henry Döllner, J
+// Image and video abstraction by anisotropic Kuwahara filtering
+// http://onlinelibrary.wiley.com/doi/10.1111/j.1467-8659.2009.01574.x/full
+// polynomial weights: Kyprianidis, Anisotropic Kuwahara Filtering with Polynomial Weighting Functions (TPCG 2010)
+//
+// the filter kernel is an ellipse aligned with the tensor orientation, stretched by the anisotropy and split into 8 sectors.
+// the output is the mean of the sector means weighted by their inverse standard deviation.
+class AnisotropicKuwahara
+{
+public:
+    enum Weighting
+    {
+        SECTOR_TEXTURE, // precomputed smoothed sector weights (original paper)
+        POLYNOMIAL      // polynomial approximation, no texture lookups
+    };
+
+    static const int NR_SECTORS = 8;
+
+    AnisotropicKuwahara();
+    ~AnisotropicKuwahara();
+
+    // tensors should be smoothed (outerSigma > 0), image values in [0, 1]
+    void filter(const cv::Mat_<glm::vec3> & image, const StructureTensorField & tensors, cv::Mat_<glm::vec3> & result) const;
+
+    float getRadius() const;
+    void setRadius(float radius);
+
+    // exponent of the sector standard deviation weighting
+    float getSharpness() const;
+    void setSharpness(float q);
+
+    // controls the eccentricity of the ellipse, larger values give less eccentric kernels
+    float getAlpha() const;
+    void setAlpha(float alpha);
+
+    Weighting getWeighting() const;
+    void setWeighting(Weighting weighting);
+
+    // maximum number of samples per call (e.g. 1920 * 1080 * 256 for 1080p video), kernels are subsampled
+    // to stay within the budget. 0 means unlimited
+    size_t getSampleBudget() const;
+    void setSampleBudget(size_t samples);
+
+    const cv::Mat_<float> & getSectorWeights() const;
+
+private:
+    float                       m_radius;
+    float                       m_q;
+    float                       m_alpha;
+    Weighting                   m_weighting;
+    size_t                      m_sampleBudget;
+
+    cv::Mat_<float>             m_sectorWeights;    // weights of sector 0, [-0.5, 0.5]^2 mapped to the texture
+
+    void createSectorWeights(int size);
+
+    template <bool Interior, Weighting W>
+    glm::vec3 filterPixel(const cv::Mat_<glm::vec3> & image, const StructureTensor2x2 & tensor,
+                          int i, int j, float perPixelBudget) const;
+};
+
+} // namespace linde
+
+#endif // KUWAHARA_H
@@ -10,16 +10,52 @@ namespace linde
 class GLContext;
 class Texture;
 class ComputeShader;
+class ShaderStorageBufferObject;
 
 
 class GPU_MultiGridDiffusion
 {
+public:
+    enum Cycle
+    {
+        PUSH_PULL,  // original scheme: averages of the constraints are pushed down and injected back, m_steps cycles
+        V_CYCLE,    // full multigrid initialization, then correction v-cycles until the residual is reduced
+        W_CYCLE     // same with w-cycles (two coarse corrections per level)
+    };
+
+private:
     int                             m_nSmooth;
     GLContext*                      m_context;
     std::shared_ptr<ComputeShader>  m_jacobiShader;
     std::shared_ptr<ComputeShader>  m_restrictShader;
     std::shared_ptr<ComputeShader>  m_prolongationShader;
     int                             m_steps;
+    glm::ivec3                      m_workGroupSize;
+
+    // correction scheme (V_CYCLE, W_CYCLE)
+    std::shared_ptr<ComputeShader>  m_smoothShader;
+    std::shared_ptr<ComputeShader>  m_residualShader;
+    std::shared_ptr<ComputeShader>  m_restrictResidualShader;
+    std::shared_ptr<ComputeShader>  m_prolongationAddShader;
+    std::shared_ptr<ComputeShader>  m_restrictRhsShader;
+    std::shared_ptr<ShaderStorageBufferObject> m_residualBuffer;
+    Cycle                           m_cycle;
+    int                             m_nSmoothCycle;
+    int                             m_maxCycles;
+    float                           m_tolerance;
+    float                           m_residual;
+
+    // level hierarchy, created once per size and reused by all solves. level 0 is the finest
+    int                                     m_hierarchySize;
+    int                                     m_hierarchyBatches;     // square problems side by side
+    std::vector<std::shared_ptr<Texture> >  m_levels;
+    std::vector<std::shared_ptr<Texture> >  m_pingPong;     // relaxation partner / residual of each level
+    std::vector<std::shared_ptr<Texture> >  m_rhs;          // right hand side of each level
+
+    // incremental solves: the solution of the last solve stays in m_levels[0]
+    std::shared_ptr<ComputeShader>  m_scatterShader;
+    std::shared_ptr<ShaderStorageBufferObject> m_changesBuffer;
+    cv::Mat_<glm::vec4>             m_constraints;          // input of the last solve
 
 
     GPU_MultiGridDiffusion();
@@ -31,13 +67,120 @@ public:
     // alpha channel is constraint mask
     void solve(cv::Mat_<glm::vec4> &psi);
 
+    // any number of channels sharing one constraint mask (> 0 is fixed). channels are packed into rgb batches which are
+    // placed side by side in one texture hierarchy and solved with the same dispatches
+    void solve(std::vector<cv::Mat_<float> > &channels, const cv::Mat_<uchar> &constraints);
+
+    // poisson equation  laplace(u) = divergence  on the free pixels, the constrained pixels are dirichlet boundary values.
+    // the divergence uses the same 4-neighborhood as the solver (see guidanceDivergence).
+    // always runs the correction scheme, PUSH_PULL is treated as V_CYCLE
+    void solvePoisson(cv::Mat_<glm::vec4> &psi, const cv::Mat_<glm::vec3> &divergence);
+    void solvePoisson(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > &divergence,
+                      const cv::Mat_<uchar> &constraints);
+
+    void setCycle(Cycle cycle) {m_cycle = cycle;}
+    // gauss-seidel sweeps before and after each coarse grid correction
+    void setSmoothingSteps(int nSmooth) {m_nSmoothCycle = nSmooth;}
+    void setMaxCycles(int maxCycles) {m_maxCycles = maxCycles;}
+    // stop when the residual dropped to tolerance * residual of the full multigrid initialization
+    void setTolerance(float tolerance) {m_tolerance = tolerance;}
+
+    // uses the solution of the previous solve as initial guess. only the constraint pixels which changed since then are
+    // uploaded and at most cycles cycles are run (stops earlier at the tolerance).
+    // falls back to solve() for the first call or a different size
+    void solveIncremental(cv::Mat_<glm::vec4> &psi, int cycles = 2);
+    // the next solveIncremental is a full solve
+    void reset();
+
+    // relative residual after the last solve
+    float getResidual() const {return m_residual;}
+
 private:
-    void relaxation(std::shared_ptr<Texture> &m0, const int iterations) const;
-    void restriction(const std::shared_ptr<Texture> &u, std::shared_ptr<Texture> &U) const;
-    void prolongation(const std::shared_ptr<Texture> &U, std::shared_ptr<Texture> &u) const;
-    void vCycle(std::shared_ptr<Texture> &u) const;
+    void createHierarchy(int size, int batches = 1);
+    void solveSystem(cv::Mat_<glm::vec4> &psi, const cv::Mat_<glm::vec3> *divergence);
+    void solveSystem(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > *divergence,
+                     const cv::Mat_<uchar> &constraints);
+    void solveHierarchy(bool sources);
+    void download(cv::Mat_<glm::vec4> &psi) const;
+    void dispatch(const std::shared_ptr<ComputeShader> &shader, const std::shared_ptr<Texture> &target) const;
+    void relaxation(size_t level, const int iterations);
+    void restriction(size_t level) const;
+    void restrictRhs(size_t level) const;
+    void prolongation(size_t level) const;
+    void vCycle(size_t level);
+
+    void multigrid();
+    void correctionCycles(int maxCycles);
+    void cycle(size_t level);
+    void smoothing(size_t level, const int iterations) const;
+    float residual(size_t level, bool measure) const;
+    void restrictResidual(size_t level) const;
+    void prolongationAdd(size_t level) const;
  };
 
+// membrane interpolation on the cpu (laplace equation, constrained pixels are fixed), used without an opengl context.
+// works on arbitrary rectangles, levels are coarsened to (n + 1) / 2 without padding.
+// full multigrid initialization, then v-cycles with red-black gauss-seidel smoothing until the residual
+// dropped below tolerance (relative to the residual of the initial guess)
+class CPU_MultiGridDiffusion
+{
+    int                             m_nSmooth;
+    int                             m_steps;
+    float                           m_tolerance;
+    float                           m_residual;
+    bool                            m_initialGuess;
+
+public:
+    CPU_MultiGridDiffusion();
+    ~CPU_MultiGridDiffusion();
+
+    // alpha channel is constraint mask
+    void solve(cv::Mat_<glm::vec4> &psi);
+
+    // any number of channels sharing one constraint mask (> 0 is fixed)
+    void solve(std::vector<cv::Mat_<float> > &channels, const cv::Mat_<uchar> &constraints);
+
+    // poisson equation  laplace(u) = divergence  on the free pixels, the constrained pixels are dirichlet boundary values.
+    // the divergence uses the same 4-neighborhood as the solver (see guidanceDivergence)
+    void solvePoisson(cv::Mat_<glm::vec4> &psi, const cv::Mat_<glm::vec3> &divergence);
+    void solvePoisson(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > &divergence,
+                      const cv::Mat_<uchar> &constraints);
+
+    // gauss-seidel sweeps before and after each coarse grid correction
+    void setSmoothingSteps(int nSmooth) {m_nSmooth = nSmooth;}
+    // maximum number of v-cycles after the initialization
+    void setMaxCycles(int steps) {m_steps = steps;}
+    void setTolerance(float tolerance) {m_tolerance = tolerance;}
+    // the free pixels start from the given values: the full multigrid initialization is skipped and the v-cycles
+    // improve them directly (warm start from a previous solution)
+    void setInitialGuess(bool initialGuess) {m_initialGuess = initialGuess;}
+
+    // relative residual after the last solve
+    float getResidual() const {return m_residual;}
+
+private:
+    struct Level
+    {
+        cv::Mat_<uchar>                 fixed;
+        std::vector<cv::Mat_<float> >   u;
+        std::vector<cv::Mat_<float> >   f;
+    };
+
+    void solveSystem(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > *divergence,
+                     const cv::Mat_<uchar> &constraints);
+    void createHierarchy(std::vector<Level> &levels, const std::vector<cv::Mat_<float> > &channels,
+                         const std::vector<cv::Mat_<float> > *divergence, const cv::Mat_<uchar> &constraints) const;
+    void relaxation(Level &level, const int iterations) const;
+    float residual(const Level &level, std::vector<cv::Mat_<float> > &r) const;
+    void restriction(const std::vector<cv::Mat_<float> > &r, Level &coarse) const;
+    void prolongation(const Level &coarse, Level &fine, bool add) const;
+    void vCycle(std::vector<Level> &levels, size_t l) const;
+};
+
+// guidance field of gradient domain editing: sum over the 4-neighbors inside the image of (source(q) - source(p)),
+// e.g. the divergence for seamless cloning of source
+void guidanceDivergence(const cv::Mat_<float> &source, cv::Mat_<float> &divergence);
+
 
 
 
@@ -107,6 +107,7 @@ namespace linde
 {
 
 class GLContext;
+class GPU_MultiGridDiffusion;
 
 
 class StructureTensorField
@@ -117,6 +118,8 @@ public:
 
     StructureTensorField(void);
     StructureTensorField(int rows, int cols);
+    // wraps external memory (e.g. memory mapped), data is not copied and has to outlive the field
+    StructureTensorField(int rows, int cols, StructureTensor2x2 * data);
     ~StructureTensorField(void);
 
     void create(int rows, int cols);
@@ -149,20 +152,60 @@ public:
     void computeStructureTensors(const cv::Mat_<glm::vec3> & image, const cv::Mat_<uchar> &mask,
                                  const float innerSigma, const float outerSigma);
 
+    // same result as computeStructureTensors but processes the image in overlapping tiles, so only tile sized temporaries are needed.
+    // source delivers the image pixels of a requested rect, tiles are written into the field (keeps preallocated or wrapped memory)
+    void computeStructureTensorsTiled(const std::function<cv::Mat_<glm::vec3>(const cv::Rect &)> & source, const cv::Size & imageSize,
+                                      const float innerSigma, const float outerSigma, const int tileSize = 1024);
+    void computeStructureTensorsTiled(const cv::Mat_<glm::vec3> & image,
+                                      const float innerSigma, const float outerSigma, const int tileSize = 1024);
+
+    // tensors at numScales integration scales from minSigma to maxSigma (geometric series, 0 < minSigma <= maxSigma).
+    // every pixel takes the tensor of the scale at which its trace normalized tensor changes least to the neighboring
+    // scales (most stable orientation and coherence), any scale of the range can be selected. derivatives are
+    // computed once and blurred incrementally.
+    // scaleMap (optional) receives the selected outer sigma per pixel. recompute is refused on the result
+    void computeMultiScaleStructureTensors(const cv::Mat_<glm::vec3> & image, const float innerSigma,
+                                           const float minSigma, const float maxSigma, const int numScales,
+                                           cv::Mat_<float> * scaleMap = nullptr);
+
     void clear(int i, int j);
 
     void lineIntegralConvolution(cv::Mat_<uchar> & vis) const;
 
+    // text format, load also reads the binary format
     void save(const std::string & filename) const;
     bool load(const std::string & filename);
 
+    // binary format: 32 byte header (magic, version, rows, cols, dtype) followed by E, F, G of each pixel.
+    // float16 halves the file size, float32 files can be mapped with mapBinary
+    bool saveBinary(const std::string & filename, bool float16 = false) const;
+    bool loadBinary(const std::string & filename);
+    // maps a float32 binary file without copying, tensors are paged in on access.
+    // changes of the field are private and not written back to the file
+    bool mapBinary(const std::string & filename);
+
     void normalize();
 
     StructureTensorField clone() const;
 
+    // shares the tensors with the returned field (e.g. undo states), the first modification of either field copies them.
+    // taking snapshots is thread safe, the first modification of a shared field must not happen from several threads at once.
+    // plain copies of a field share the tensors the same way
+    StructureTensorField snapshot() const;
+
     // interpolate all values smaller equal to minValidGradient (values bertween 0...1)
+    // runs on the cpu if gl is nullptr
     void interpolate(float minValidGradient, GLContext *gl);
 
+    // recompute the tensors affected by an edit of image inside dirty, only a window around dirty is filtered.
+    // uses sigmas, normalization and interpolation threshold of the last computation, holes are refilled locally
+    void recompute(const cv::Mat_<glm::vec3> & image, const cv::Rect & dirty, GLContext *gl);
+    void recompute(const cv::Mat_<glm::vec3> & image, const cv::Mat_<uchar> & mask, const cv::Rect & dirty, GLContext *gl);
+
+    // number of pixels in each direction a tensor depends on (sobel, inner and outer blur)
+    static
+    int supportRadius(float innerSigma, float outerSigma);
+
     static
     StructureTensorField computeStructureTensorField(GLContext* gl, const cv::Mat_<glm::vec3> & input_image, float inner_sigma, float outer_sigma, float threshold);
 
@@ -179,6 +222,138 @@ public:
 private:
 
     cv::Mat_<StructureTensor2x2> m_tensors;
+    // keeps a file mapping alive as long as m_tensors points into it
+    std::shared_ptr<void> m_mapping;
+    // share token, created with the field and copied with the tensors. use count > 1 while they are shared
+    std::shared_ptr<void> m_shared;
+
+    // parameters of the last computation, needed for recompute
+    float m_innerSigma;
+    float m_outerSigma;
+    bool m_multiScale;  // outer sigma varies per pixel, recompute is not possible
+    float m_scale;      // scaling applied by normalize
+    float m_threshold;  // threshold of the last interpolation, negative if not interpolated
+
+    // compute the tensors inside target from the pixels of window (located at windowRect) and store them scaled
+    void computeRegion(const cv::Mat_<glm::vec3> & window, const cv::Mat_<uchar> & mask, const cv::Rect & windowRect,
+                       const cv::Rect & target, float scale);
+
+    // copy on write, called before m_tensors is modified. keepContent false if the tensors are overwritten anyway
+    void detach(bool keepContent = true)
+    {
+        if (m_shared.use_count() != 1) unshare(keepContent);
+    }
+    void unshare(bool keepContent);
+
+    // interpolate all tensors inside roi which are not marked in constraints (roi sized)
+    void interpolate(const cv::Rect & roi, const cv::Mat_<uchar> & constraints, GLContext *gl);
+
+    friend class TemporalStructureTensorField;
+
+};
+
+
+// running tensor field of a video. tiles whose mean frame difference (to the frame they were last computed from)
+// exceeds changeThreshold are recomputed, static tiles are skipped. the output follows the recomputed
+// tensors with exponential smoothing: out = alpha * new + (1 - alpha) * out.
+// the holes of the recomputed regions are refilled starting from the previous frame's interpolation. on the gpu a
+// persistent solver solves the whole frame incrementally: only changed constraints are uploaded. the cpu solves every
+// recomputed region on its own, with the previous interpolation around it as boundary values.
+class TemporalStructureTensorField
+{
+public:
+    TemporalStructureTensorField(float innerSigma, float outerSigma, float threshold,
+                                 float alpha = 0.5f, float changeThreshold = 0.01f, int tileSize = 64);
+
+    // integrates the next frame, the first frame (or a frame of different size) is computed from scratch
+    const StructureTensorField & update(const cv::Mat_<glm::vec3> & frame, GLContext *gl);
+
+    const StructureTensorField & getField() const {return m_field;}
+    // number of tiles recomputed by the last update
+    int getRecomputedTiles() const {return m_recomputedTiles;}
+
+    void reset();
+
+private:
+
+    float m_innerSigma;
+    float m_outerSigma;
+    float m_threshold;
+    float m_alpha;
+    float m_changeThreshold;
+    int m_tileSize;
+    int m_recomputedTiles;
+
+    StructureTensorField m_current;     // tensors of the latest frame content (unsmoothed)
+    StructureTensorField m_field;       // smoothed output
+    cv::Mat_<glm::vec3> m_reference;    // frame content each tile was last computed from
+    cv::Mat_<uchar> m_blending;         // per tile, output has not converged to m_current yet
+    cv::Mat_<uchar> m_holes;            // per pixel, tensor of m_current is interpolated
+
+    std::shared_ptr<GPU_MultiGridDiffusion> m_solver;
+    GLContext *m_solverContext;
+
+    // refill the holes of m_current inside the regions (the whole frame on the gpu). without warmStart the cpu
+    // solves the regions from scratch
+    void fillHoles(const std::vector<cv::Rect> & regions, GLContext *gl, bool warmStart);
+
+};
+
+
+// quantized tensor field, stores orientation, anisotropy and trace (E + G) of each tensor instead of E, F, G.
+// HIGH: 16 bit each (6 bytes per pixel), LOW: 16 bit orientation, 8 bit anisotropy and trace (4 bytes per pixel).
+// tensors are decoded on access, error bounds (PSD tensors):
+//  orientation:    |error| <= pi / 2^17 rad (both precisions)
+//  anisotropy:     |error| <= 0.5 / 65535 (HIGH), 0.5 / 255 (LOW)
+//  trace:          stored as sqrt(trace / maxTrace), |error| of that value <= 0.5 / 65535 (HIGH), 0.5 / 255 (LOW)
+class CompactStructureTensorField
+{
+public:
+    enum Precision
+    {
+        HIGH,
+        LOW
+    };
+
+    int rows;
+    int cols;
+
+    CompactStructureTensorField(void);
+    CompactStructureTensorField(const StructureTensorField & field, Precision precision = HIGH);
+
+    void encode(const StructureTensorField & field, Precision precision = HIGH);
+    StructureTensorField decode() const;
+
+    cv::Size size() const {return m_orientation.size();}
+    Precision getPrecision() const {return m_precision;}
+    int bytesPerPixel() const {return m_precision == HIGH ? 6 : 4;}
+
+    StructureTensor2x2 getTensor(int i, int j) const;
+    // bilinear interpolation of the decoded tensors
+    StructureTensor2x2 getTensor(const glm::vec2 & pos) const;
+
+    float getMinEigenvalue(int i, int j) const;
+    float getMaxEigenvalue(int i, int j) const;
+    float getAnisotropy(int i, int j) const;
+
+    glm::vec2 getMinEigenvector(int i, int j) const;
+    glm::vec2 getMinEigenvector(const glm::vec2 & pos) const;
+    glm::vec2 getMaxEigenvector(int i, int j) const;
+    glm::vec2 getMaxEigenvector(const glm::vec2 & pos) const;
+
+    static
+    void RungeKutta4_MinEigenvector(const CompactStructureTensorField & field, const glm::vec2 & pos, glm::vec2 & dir, float stepSize = sqrt(2.f), bool normalize = true);
+    static
+    void RungeKutta4_MaxEigenvector(const CompactStructureTensorField & field, const glm::vec2 & pos, glm::vec2 & dir, float stepSize = sqrt(2.f), bool normalize = true);
+
+private:
+
+    Precision m_precision;
+    float m_maxTrace;
+
+    cv::Mat_<ushort> m_orientation;     // 2 * phi mapped from [-pi, pi) to [0, 65536)
+    cv::Mat m_anisotropy;               // CV_16U (HIGH) or CV_8U (LOW)
+    cv::Mat m_trace;                    // sqrt(trace / m_maxTrace), CV_16U (HIGH) or CV_8U (LOW)
 
 };
 } // namespace linde
@@ -34,12 +34,14 @@ void main()
         ivec2 rx = ivec2(index.x+1, index.y);
         ivec2 uy = ivec2(index.x, index.y-1);
         ivec2 dy = ivec2(index.x, index.y+1);
-        if (lx.x >= 0)
+        // square tiles of independent problems side by side, no neighbors across tiles
+        int tileX = index.x % texSize.y;
+        if (tileX > 0)
         {
             M += imageLoad(map0, lx).xyz;
             n++;
         }
-        if (rx.x < texSize.x)
+        if (tileX < texSize.y - 1)
         {
             M += imageLoad(map0, rx).xyz;
             n++;
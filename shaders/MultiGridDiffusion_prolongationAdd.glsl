@@ -0,0 +1,34 @@
+//Author: Thomas Lindemeier
+
+#version 440
+
+// OpenGL 4.3
+layout (local_size_x = 32, local_size_y = 32) in;
+
+// adds the bilinear (cell centered) interpolated coarse correction to the free fine pixels
+layout (binding = 0, rgba32f) readonly uniform image2D E;
+layout (binding = 1, rgba32f) uniform image2D u;
+
+void main()
+{
+    ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+
+    ivec2 coarseSize = imageSize(E);
+    ivec2 fineSize = imageSize(u);
+
+    if (index.x >= fineSize.x || index.y >= fineSize.y || index.x < 0  || index.y < 0) return;
+
+    vec4 u00 = imageLoad(u, index);
+    if (u00.a > 0.0) return;
+
+    ivec2 I0 = index / 2;
+    // clamped to the square tile of I0
+    ivec2 tile0 = ivec2((I0.x / coarseSize.y) * coarseSize.y, 0);
+    ivec2 I1 = clamp(I0 + ivec2((index.x & 1) == 1 ? 1 : -1, (index.y & 1) == 1 ? 1 : -1), tile0, tile0 + coarseSize.y - 1);
+
+    vec3 e = 0.5625 * imageLoad(E, I0).rgb
+           + 0.1875 * (imageLoad(E, ivec2(I1.x, I0.y)).rgb + imageLoad(E, ivec2(I0.x, I1.y)).rgb)
+           + 0.0625 * imageLoad(E, I1).rgb;
+
+    imageStore(u, index, vec4(u00.rgb + e, 0.0));
+}
@@ -0,0 +1,64 @@
+//Author: Thomas Lindemeier
+
+#version 440
+
+// OpenGL 4.3
+layout (local_size_x = 32, local_size_y = 32) in;
+
+// r = f - (n * u - sum(neighbors)) on the free pixels, alpha keeps the constraint flag
+layout (binding = 0, rgba32f) readonly uniform image2D u;
+layout (binding = 1, rgba32f) readonly uniform image2D f;
+layout (binding = 2, rgba32f) writeonly uniform image2D r;
+
+// maximum norm of the residual, bits of a positive float compare like unsigned integers
+layout (std430, binding = 3) buffer ResidualBuffer
+{
+    uint maxResidual;
+};
+
+void main()
+{
+    ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+
+    ivec2 texSize = imageSize(u);
+
+    if (index.x >= texSize.x || index.y >= texSize.y || index.x < 0  || index.y < 0) return;
+
+    vec4 u00 = imageLoad(u, index);
+    if (u00.a > 0.0)
+    {
+        imageStore(r, index, vec4(0.0, 0.0, 0.0, u00.a));
+        return;
+    }
+
+    vec3 M = imageLoad(f, index).rgb;
+    float n = 0;
+    // square tiles of independent problems side by side, no neighbors across tiles
+    int tileX = index.x % texSize.y;
+    if (tileX > 0)
+    {
+        M += imageLoad(u, index - ivec2(1, 0)).rgb;
+        n++;
+    }
+    if (tileX < texSize.y - 1)
+    {
+        M += imageLoad(u, index + ivec2(1, 0)).rgb;
+        n++;
+    }
+    if (index.y > 0)
+    {
+        M += imageLoad(u, index - ivec2(0, 1)).rgb;
+        n++;
+    }
+    if (index.y < texSize.y - 1)
+    {
+        M += imageLoad(u, index + ivec2(0, 1)).rgb;
+        n++;
+    }
+    M -= n * u00.rgb;
+
+    imageStore(r, index, vec4(M, 0.0));
+
+    vec3 a = abs(M);
+    atomicMax(maxResidual, floatBitsToUint(max(a.r, max(a.g, a.b))));
+}
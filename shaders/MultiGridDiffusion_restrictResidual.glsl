@@ -0,0 +1,33 @@
+//Author: Thomas Lindemeier
+
+#version 440
+
+// OpenGL 4.3
+layout (local_size_x = 32, local_size_y = 32) in;
+
+// coarse grid problem of the correction: rhs is the sum of the children residuals (four times the area),
+// a coarse cell is fixed (correction 0) if any child is fixed
+layout (binding = 0, rgba32f) readonly uniform image2D r;
+layout (binding = 1, rgba32f) writeonly uniform image2D U;
+layout (binding = 2, rgba32f) writeonly uniform image2D F;
+
+void main()
+{
+    ivec2 INDEX = ivec2(gl_GlobalInvocationID.xy);
+
+    ivec2 coarseSize = imageSize(U);
+
+    ivec2 index = 2 * INDEX;
+
+    if (INDEX.x >= coarseSize.x || INDEX.y >= coarseSize.y || INDEX.x < 0  || INDEX.y < 0) return;
+
+    vec4 a = imageLoad(r, index);
+    vec4 b = imageLoad(r, index + ivec2(1, 0));
+    vec4 c = imageLoad(r, index + ivec2(0, 1));
+    vec4 d = imageLoad(r, index + ivec2(1, 1));
+
+    float isFixed = max(max(a.a, b.a), max(c.a, d.a)) > 0.0 ? 1.0 : 0.0;
+
+    imageStore(U, INDEX, vec4(0.0, 0.0, 0.0, isFixed));
+    imageStore(F, INDEX, isFixed > 0.0 ? vec4(0.0) : vec4(a.rgb + b.rgb + c.rgb + d.rgb, 0.0));
+}
@@ -0,0 +1,28 @@
+//Author: Thomas Lindemeier
+
+#version 440
+
+// OpenGL 4.3
+layout (local_size_x = 32, local_size_y = 32) in;
+
+// sources of the full problem on the coarse grid: sum of the children (four times the area)
+layout (binding = 0, rgba32f) readonly uniform image2D f;
+layout (binding = 1, rgba32f) writeonly uniform image2D F;
+
+void main()
+{
+    ivec2 INDEX = ivec2(gl_GlobalInvocationID.xy);
+
+    ivec2 coarseSize = imageSize(F);
+
+    ivec2 index = 2 * INDEX;
+
+    if (INDEX.x >= coarseSize.x || INDEX.y >= coarseSize.y || INDEX.x < 0  || INDEX.y < 0) return;
+
+    vec3 sum = imageLoad(f, index).rgb
+             + imageLoad(f, index + ivec2(1, 0)).rgb
+             + imageLoad(f, index + ivec2(0, 1)).rgb
+             + imageLoad(f, index + ivec2(1, 1)).rgb;
+
+    imageStore(F, INDEX, vec4(sum, 0.0));
+}
@@ -0,0 +1,40 @@
+//Author: Thomas Lindemeier
+
+#version 440
+
+// OpenGL 4.3
+layout (local_size_x = 256) in;
+
+// writes changed constraint pixels into the finest level, the rest of the previous solution is kept
+layout (binding = 0, rgba32f) uniform image2D u;
+
+struct Change
+{
+    vec4    value;      // alpha > 0: constraint, alpha == 0: pixel was released
+    ivec2   position;
+    ivec2   padding;
+};
+
+layout (std430, binding = 1) readonly buffer Changes
+{
+    Change changes[];
+};
+
+uniform int count;
+
+void main()
+{
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= count) return;
+
+    Change c = changes[index];
+    if (c.value.a > 0.0)
+    {
+        imageStore(u, c.position, c.value);
+    }
+    else
+    {
+        // released pixels keep their old value as initial guess
+        imageStore(u, c.position, vec4(imageLoad(u, c.position).rgb, 0.0));
+    }
+}
@@ -0,0 +1,56 @@
+//Author: Thomas Lindemeier
+
+#version 440
+
+// OpenGL 4.3
+layout (local_size_x = 32, local_size_y = 32) in;
+
+// red-black gauss-seidel sweep for  n * u - sum(neighbors) = f  on the free pixels (alpha == 0)
+layout (binding = 0, rgba32f) uniform image2D u;
+layout (binding = 1, rgba32f) readonly uniform image2D f;
+
+// 0 red, 1 black
+uniform int color;
+
+void main()
+{
+    ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+
+    ivec2 texSize = imageSize(u);
+
+    if (index.x >= texSize.x || index.y >= texSize.y || index.x < 0  || index.y < 0) return;
+    if (((index.x + index.y) & 1) != color) return;
+
+    vec4 u00 = imageLoad(u, index);
+    if (u00.a > 0.0) return;
+
+    vec3 M = imageLoad(f, index).rgb;
+    float n = 0;
+    // square tiles of independent problems side by side, no neighbors across tiles
+    int tileX = index.x % texSize.y;
+    if (tileX > 0)
+    {
+        M += imageLoad(u, index - ivec2(1, 0)).rgb;
+        n++;
+    }
+    if (tileX < texSize.y - 1)
+    {
+        M += imageLoad(u, index + ivec2(1, 0)).rgb;
+        n++;
+    }
+    if (index.y > 0)
+    {
+        M += imageLoad(u, index - ivec2(0, 1)).rgb;
+        n++;
+    }
+    if (index.y < texSize.y - 1)
+    {
+        M += imageLoad(u, index + ivec2(0, 1)).rgb;
+        n++;
+    }
+
+    if (n > 0)
+    {
+        imageStore(u, index, vec4(M / n, 0.0));
+    }
+}
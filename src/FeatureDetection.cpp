@@ -0,0 +1,172 @@
+#include "../include/linde/FeatureDetection.h"
+
+#include <algorithm>
+
+namespace linde
+{
+
+void cornerResponses(const StructureTensorField & tensors, cv::Mat_<float> * minEigenvalue, cv::Mat_<float> * harris, float k)
+{
+    const cv::Mat_<StructureTensor2x2> & t = tensors.getTensors();
+    if (minEigenvalue) minEigenvalue->create(t.size());
+    if (harris) harris->create(t.size());
+
+    // plain loops over the rows so the compiler can vectorize them
+    parallel_for(0, t.rows, [&](int i)
+    {
+        const StructureTensor2x2 * row = t[i];
+        if (minEigenvalue)
+        {
+            float * out = (*minEigenvalue)[i];
+            for (int j = 0; j < t.cols; j++)
+            {
+                const float E = row[j].E, F = row[j].F, G = row[j].G;
+                out[j] = 0.5f * (E + G - std::sqrt((E - G) * (E - G) + 4.f * F * F));
+            }
+        }
+        if (harris)
+        {
+            float * out = (*harris)[i];
+            for (int j = 0; j < t.cols; j++)
+            {
+                const float E = row[j].E, F = row[j].F, G = row[j].G;
+                out[j] = E * G - F * F - k * (E + G) * (E + G);
+            }
+        }
+    });
+}
+
+void cornerResponse(const StructureTensorField & tensors, cv::Mat_<float> & response, CornerResponse type, float k)
+{
+    if (type == CORNER_MIN_EIGENVALUE)
+    {
+        cornerResponses(tensors, &response, nullptr, k);
+    }
+    else
+    {
+        cornerResponses(tensors, nullptr, &response, k);
+    }
+}
+
+void nonMaximumSuppression(const cv::Mat_<float> & response, cv::Mat_<uchar> & maxima, int radius, float threshold)
+{
+    maxima.create(response.size());
+
+    parallel_for(0, response.rows, [&](int i)
+    {
+        const int y0 = std::max(0, i - radius);
+        const int y1 = std::min(response.rows - 1, i + radius);
+        uchar * out = maxima[i];
+        for (int j = 0; j < response.cols; j++)
+        {
+            const float v = response(i, j);
+            out[j] = 0;
+            if (v < threshold) continue;
+
+            const int x0 = std::max(0, j - radius);
+            const int x1 = std::min(response.cols - 1, j + radius);
+            bool isMax = true;
+            for (int y = y0; y <= y1 && isMax; y++)
+            {
+                const float * r = response[y];
+                for (int x = x0; x <= x1; x++)
+                {
+                    // plateaus keep their first pixel in scan order
+                    if (r[x] > v || (r[x] == v && (y < i || (y == i && x < j))))
+                    {
+                        isMax = false;
+                        break;
+                    }
+                }
+            }
+            out[j] = isMax ? 255 : 0;
+        }
+    });
+}
+
+std::vector<Feature> selectFeatures(const cv::Mat_<float> & response, int maxFeatures, float qualityLevel,
+                                    float minDistance, int nmsRadius)
+{
+    double maxResponse = 0.0;
+    cv::minMaxLoc(response, nullptr, &maxResponse);
+    if (maxResponse <= 0.0) return std::vector<Feature>();
+
+    cv::Mat_<uchar> maxima;
+    nonMaximumSuppression(response, maxima, nmsRadius, (float)(qualityLevel * maxResponse));
+
+    // candidates per row in parallel, merged afterwards
+    std::vector<std::vector<Feature> > rowCandidates(response.rows);
+    parallel_for(0, response.rows, [&](int i)
+    {
+        for (int j = 0; j < response.cols; j++)
+        {
+            if (maxima(i, j))
+            {
+                rowCandidates[i].push_back({glm::vec2(j, i), response(i, j)});
+            }
+        }
+    });
+
+    std::vector<Feature> candidates;
+    for (const std::vector<Feature> & row : rowCandidates)
+    {
+        candidates.insert(candidates.end(), row.begin(), row.end());
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Feature & a, const Feature & b)
+    {
+        return a.response > b.response;
+    });
+
+    const size_t limit = (maxFeatures > 0) ? (size_t)maxFeatures : candidates.size();
+    if (minDistance <= 1.f)
+    {
+        if (candidates.size() > limit) candidates.resize(limit);
+        return candidates;
+    }
+
+    // greedy selection, accepted features are binned into cells of size minDistance so only 3x3 cells are tested
+    const float minDist2 = minDistance * minDistance;
+    const int gridCols = (int)std::ceil(response.cols / minDistance);
+    const int gridRows = (int)std::ceil(response.rows / minDistance);
+    std::vector<std::vector<glm::vec2> > grid(gridCols * gridRows);
+
+    std::vector<Feature> features;
+    for (const Feature & f : candidates)
+    {
+        if (features.size() >= limit) break;
+
+        const int cx = (int)(f.position.x / minDistance);
+        const int cy = (int)(f.position.y / minDistance);
+        bool isFree = true;
+        for (int y = std::max(0, cy - 1); y <= std::min(gridRows - 1, cy + 1) && isFree; y++)
+        {
+            for (int x = std::max(0, cx - 1); x <= std::min(gridCols - 1, cx + 1) && isFree; x++)
+            {
+                for (const glm::vec2 & p : grid[y * gridCols + x])
+                {
+                    if (glm::distance2(p, f.position) < minDist2)
+                    {
+                        isFree = false;
+                        break;
+                    }
+                }
+            }
+        }
+        if (!isFree) continue;
+
+        grid[cy * gridCols + cx].push_back(f.position);
+        features.push_back(f);
+    }
+
+    return features;
+}
+
+std::vector<Feature> detectFeatures(const StructureTensorField & tensors, CornerResponse type, int maxFeatures,
+                                    float qualityLevel, float minDistance, float k)
+{
+    cv::Mat_<float> response;
+    cornerResponse(tensors, response, type, k);
+    return selectFeatures(response, maxFeatures, qualityLevel, minDistance);
+}
+
+} // namespace linde
@@ -0,0 +1,279 @@
+#include "../include/linde/FlowDoG.h"
+#include "../include/linde/Convolution.h"
+
+#include <climits>
+#include <iostream>
+
+namespace linde
+{
+
+// streamline offsets are stored in fixed point
+static const float STREAMLINE_PRECISION = 64.f;
+static const short STREAMLINE_END = SHRT_MIN;
+
+static const int TILE_SIZE = 64;
+
+FlowDoG::FlowDoG() :
+    m_sigmaC(1.f),
+    m_rho(0.99f),
+    m_tau(0.5f),
+    m_sigmaM(3.f),
+    m_rows(0),
+    m_cols(0),
+    m_streamlineLength(0)
+{
+
+}
+
+FlowDoG::~FlowDoG()
+{
+
+}
+
+float FlowDoG::getSigmaC() const
+{
+    return m_sigmaC;
+}
+
+void FlowDoG::setSigmaC(float sigmaC)
+{
+    if (!(sigmaC > 0.f))
+    {
+        std::cerr << "FlowDoG: sigmaC must be positive" << std::endl;
+        return;
+    }
+    m_sigmaC = sigmaC;
+}
+
+float FlowDoG::getRho() const
+{
+    return m_rho;
+}
+
+void FlowDoG::setRho(float rho)
+{
+    m_rho = rho;
+}
+
+float FlowDoG::getTau() const
+{
+    return m_tau;
+}
+
+void FlowDoG::setTau(float tau)
+{
+    m_tau = tau;
+}
+
+float FlowDoG::getSigmaM() const
+{
+    return m_sigmaM;
+}
+
+// runs func(rect) for all tiles in parallel
+template <class Function>
+static void forEachTile(int rows, int cols, Function func)
+{
+    const int tilesY = (rows + TILE_SIZE - 1) / TILE_SIZE;
+    const int tilesX = (cols + TILE_SIZE - 1) / TILE_SIZE;
+    parallel_for(0, tilesY * tilesX, [&](int t)
+    {
+        func(cv::Rect((t % tilesX) * TILE_SIZE, (t / tilesX) * TILE_SIZE, TILE_SIZE, TILE_SIZE) & cv::Rect(0, 0, cols, rows));
+    });
+}
+
+// bilinear lookup, clamped to the image
+static inline float sampleClamped(const cv::Mat_<float> & mat, float x, float y)
+{
+    x = glm::clamp(x, 0.f, mat.cols - 1.f);
+    y = glm::clamp(y, 0.f, mat.rows - 1.f);
+    const int x0 = (int)x;
+    const int y0 = (int)y;
+    const int x1 = std::min(x0 + 1, mat.cols - 1);
+    const int y1 = std::min(y0 + 1, mat.rows - 1);
+    const float fx = x - x0;
+    const float fy = y - y0;
+    return (1.f - fx) * (1.f - fy) * mat(y0, x0) + fx * (1.f - fy) * mat(y0, x1)
+            + (1.f - fx) * fy * mat(y1, x0) + fx * fy * mat(y1, x1);
+}
+
+static inline glm::vec2 tangent(const StructureTensor2x2 & t)
+{
+    const glm::vec2 v = t.getMinEigenvector();
+    const float l = glm::length(v);
+    return (l > 0.f) ? v / l : glm::vec2(1.f, 0.f);
+}
+
+void FlowDoG::setTensorField(const StructureTensorField & tensors, float sigmaM)
+{
+    if (!(sigmaM > 0.f))
+    {
+        std::cerr << "FlowDoG: sigmaM must be positive" << std::endl;
+        return;
+    }
+    m_sigmaM = sigmaM;
+    m_rows = tensors.rows;
+    m_cols = tensors.cols;
+    m_streamlineLength = gaussKernelRadiusFromSigma(sigmaM);
+
+    const int nrSamples = std::max(1, 2 * m_streamlineLength);
+    m_gradient.create(m_rows, m_cols);
+    m_streamlines.create(m_rows * m_cols, nrSamples);
+
+    forEachTile(m_rows, m_cols, [&](const cv::Rect & tile)
+    {
+        for (int i = tile.y; i < tile.y + tile.height; i++)
+        {
+            for (int j = tile.x; j < tile.x + tile.width; j++)
+            {
+                const glm::vec2 t0 = tangent(tensors(i, j));
+                m_gradient(i, j) = glm::vec2(-t0.y, t0.x);
+
+                cv::Vec2s * samples = m_streamlines[i * m_cols + j];
+                // forward (+t0) and backward (-t0), unit steps, the orientation is kept consistent
+                for (int d = 0; d < 2; d++)
+                {
+                    glm::vec2 pos(j, i);
+                    glm::vec2 dir = (d == 0) ? t0 : -t0;
+                    bool inside = true;
+                    for (int k = 0; k < m_streamlineLength; k++)
+                    {
+                        cv::Vec2s & sample = samples[d * m_streamlineLength + k];
+                        if (inside)
+                        {
+                            pos += dir;
+                            inside = pos.x >= 0.f && pos.y >= 0.f && pos.x <= m_cols - 1.f && pos.y <= m_rows - 1.f;
+                        }
+                        if (!inside)
+                        {
+                            sample = cv::Vec2s(STREAMLINE_END, STREAMLINE_END);
+                            continue;
+                        }
+                        sample = cv::Vec2s((short)glm::round((pos.x - j) * STREAMLINE_PRECISION),
+                                           (short)glm::round((pos.y - i) * STREAMLINE_PRECISION));
+
+                        glm::vec2 next = tangent(tensors.getTensor((int)glm::round(pos.y), (int)glm::round(pos.x)));
+                        if (glm::dot(next, dir) < 0.f) next = -next;
+                        dir = next;
+                    }
+                }
+            }
+        }
+    });
+}
+
+void FlowDoG::gradientDoG(const cv::Mat_<float> & luminance, cv::Mat_<float> & response) const
+{
+    const float sigmaS = 1.6f * m_sigmaC;
+    const int radius = gaussKernelRadiusFromSigma(sigmaS);
+
+    // both gaussians normalized, sampled at the same positions
+    std::vector<float> weights(2 * radius + 1);
+    float sumC = 0.f, sumS = 0.f;
+    for (int t = -radius; t <= radius; t++)
+    {
+        sumC += std::exp(-(t * t) / (2.f * m_sigmaC * m_sigmaC));
+        sumS += std::exp(-(t * t) / (2.f * sigmaS * sigmaS));
+    }
+    for (int t = -radius; t <= radius; t++)
+    {
+        weights[t + radius] = std::exp(-(t * t) / (2.f * m_sigmaC * m_sigmaC)) / sumC
+                - m_rho * std::exp(-(t * t) / (2.f * sigmaS * sigmaS)) / sumS;
+    }
+
+    response.create(luminance.size());
+    forEachTile(m_rows, m_cols, [&](const cv::Rect & tile)
+    {
+        for (int i = tile.y; i < tile.y + tile.height; i++)
+        {
+            for (int j = tile.x; j < tile.x + tile.width; j++)
+            {
+                const glm::vec2 g = m_gradient(i, j);
+                float sum = 0.f;
+                for (int t = -radius; t <= radius; t++)
+                {
+                    sum += weights[t + radius] * sampleClamped(luminance, j + t * g.x, i + t * g.y);
+                }
+                response(i, j) = sum;
+            }
+        }
+    });
+}
+
+void FlowDoG::flowSmoothing(const cv::Mat_<float> & response, cv::Mat_<float> & smoothed) const
+{
+    std::vector<float> weights(m_streamlineLength + 1);
+    for (int k = 0; k <= m_streamlineLength; k++)
+    {
+        weights[k] = std::exp(-(k * k) / (2.f * m_sigmaM * m_sigmaM));
+    }
+
+    smoothed.create(response.size());
+    forEachTile(m_rows, m_cols, [&](const cv::Rect & tile)
+    {
+        for (int i = tile.y; i < tile.y + tile.height; i++)
+        {
+            for (int j = tile.x; j < tile.x + tile.width; j++)
+            {
+                float sum = weights[0] * response(i, j);
+                float wsum = weights[0];
+
+                const cv::Vec2s * samples = m_streamlines[i * m_cols + j];
+                for (int d = 0; d < 2; d++)
+                {
+                    for (int k = 0; k < m_streamlineLength; k++)
+                    {
+                        const cv::Vec2s & s = samples[d * m_streamlineLength + k];
+                        if (s[0] == STREAMLINE_END) break;
+                        const float w = weights[k + 1];
+                        sum += w * sampleClamped(response, j + s[0] / STREAMLINE_PRECISION, i + s[1] / STREAMLINE_PRECISION);
+                        wsum += w;
+                    }
+                }
+                smoothed(i, j) = sum / wsum;
+            }
+        }
+    });
+}
+
+void FlowDoG::filterResponse(const cv::Mat_<float> & luminance, cv::Mat_<float> & response) const
+{
+    myassert(luminance.rows == m_rows && luminance.cols == m_cols);
+
+    cv::Mat_<float> dog;
+    gradientDoG(luminance, dog);
+    flowSmoothing(dog, response);
+}
+
+void FlowDoG::filter(const cv::Mat_<float> & luminance, cv::Mat_<float> & result, int iterations) const
+{
+    cv::Mat_<float> input = luminance;
+    cv::Mat_<float> response;
+    result.create(luminance.size());
+
+    for (int it = 0; it < std::max(1, iterations); it++)
+    {
+        filterResponse(input, response);
+
+        parallel_for(0, m_rows, [&](int i)
+        {
+            for (int j = 0; j < m_cols; j++)
+            {
+                const float h = response(i, j);
+                result(i, j) = (h < 0.f && 1.f + std::tanh(h) < m_tau) ? 0.f : 1.f;
+            }
+        });
+
+        // superimpose the lines on the original image
+        if (it + 1 < iterations)
+        {
+            input = luminance.clone();
+            for (int i = 0; i < m_rows * m_cols; i++)
+            {
+                if (result(i) == 0.f) input(i) = 0.f;
+            }
+        }
+    }
+}
+
+} // namespace linde
@@ -0,0 +1,296 @@
+#include "../include/linde/Kuwahara.h"
+#include "../include/linde/Convolution.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace linde
+{
+
+AnisotropicKuwahara::AnisotropicKuwahara() :
+    m_radius(6.f),
+    m_q(8.f),
+    m_alpha(1.f),
+    m_weighting(POLYNOMIAL),
+    m_sampleBudget(0)
+{
+    createSectorWeights(32);
+}
+
+AnisotropicKuwahara::~AnisotropicKuwahara()
+{
+
+}
+
+float AnisotropicKuwahara::getRadius() const
+{
+    return m_radius;
+}
+
+void AnisotropicKuwahara::setRadius(float radius)
+{
+    m_radius = std::max(1.f, radius);
+}
+
+float AnisotropicKuwahara::getSharpness() const
+{
+    return m_q;
+}
+
+void AnisotropicKuwahara::setSharpness(float q)
+{
+    m_q = q;
+}
+
+float AnisotropicKuwahara::getAlpha() const
+{
+    return m_alpha;
+}
+
+void AnisotropicKuwahara::setAlpha(float alpha)
+{
+    m_alpha = std::max(0.01f, alpha);
+}
+
+AnisotropicKuwahara::Weighting AnisotropicKuwahara::getWeighting() const
+{
+    return m_weighting;
+}
+
+void AnisotropicKuwahara::setWeighting(Weighting weighting)
+{
+    m_weighting = weighting;
+}
+
+size_t AnisotropicKuwahara::getSampleBudget() const
+{
+    return m_sampleBudget;
+}
+
+void AnisotropicKuwahara::setSampleBudget(size_t samples)
+{
+    m_sampleBudget = samples;
+}
+
+const cv::Mat_<float> &AnisotropicKuwahara::getSectorWeights() const
+{
+    return m_sectorWeights;
+}
+
+// K_0 = (chi_0 * G_sigma_s) * G_sigma_r, chi_0 is the indicator of sector 0 inside the disc of radius 0.5
+void AnisotropicKuwahara::createSectorWeights(int size)
+{
+    cv::Mat_<float> sector(size, size);
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            const glm::vec2 p((j + 0.5f) / size - 0.5f, (i + 0.5f) / size - 0.5f);
+            const float angle = std::atan2(p.y, p.x);
+            const bool inside = glm::length(p) <= 0.5f && std::abs(angle) <= PI<float>() / NR_SECTORS;
+            sector(i, j) = inside ? 1.f : 0.f;
+        }
+    }
+
+    const float sigmaS = 1.f;
+    const int k_size = gaussKernelSizeFromSigma(sigmaS);
+    cv::GaussianBlur(sector, sector, cv::Size(k_size, k_size), sigmaS, 0.0, cv::BORDER_CONSTANT);
+
+    const float sigmaR = 0.2f;
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            const glm::vec2 p((j + 0.5f) / size - 0.5f, (i + 0.5f) / size - 0.5f);
+            sector(i, j) *= std::exp(-glm::dot(p, p) / (2.f * sigmaR * sigmaR));
+        }
+    }
+    m_sectorWeights = sector;
+}
+
+// bilinear lookup of v in [-0.5, 0.5]^2
+static inline float sampleWeights(const cv::Mat_<float> & weights, const glm::vec2 & v)
+{
+    const float x = glm::clamp((v.x + 0.5f) * weights.cols - 0.5f, 0.f, weights.cols - 1.f);
+    const float y = glm::clamp((v.y + 0.5f) * weights.rows - 0.5f, 0.f, weights.rows - 1.f);
+    const int x0 = (int)x;
+    const int y0 = (int)y;
+    const int x1 = std::min(x0 + 1, weights.cols - 1);
+    const int y1 = std::min(y0 + 1, weights.rows - 1);
+    const float fx = x - x0;
+    const float fy = y - y0;
+    return (1.f - fx) * (1.f - fy) * weights(y0, x0) + fx * (1.f - fy) * weights(y0, x1)
+            + (1.f - fx) * fy * weights(y1, x0) + fx * fy * weights(y1, x1);
+}
+
+template <bool Interior, AnisotropicKuwahara::Weighting W>
+glm::vec3 AnisotropicKuwahara::filterPixel(const cv::Mat_<glm::vec3> & image, const StructureTensor2x2 & tensor,
+                                           int i, int j, float perPixelBudget) const
+{
+    // tangent direction (minor eigenvector) and anisotropy
+    glm::vec2 t = tensor.getMinEigenvector();
+    const float l = glm::length(t);
+    t = (l > 0.f) ? t / l : glm::vec2(1.f, 0.f);
+    const float A = tensor.getAnisotropy();
+
+    const float a = m_radius * glm::clamp((m_alpha + A) / m_alpha, 0.1f, 2.f);
+    const float b = m_radius * glm::clamp(m_alpha / (m_alpha + A), 0.1f, 2.f);
+
+    const float cos_phi = t.x;
+    const float sin_phi = t.y;
+
+    // maps offsets onto the disc of radius 0.5
+    const glm::vec2 sr0 = glm::vec2(cos_phi, sin_phi) * (0.5f / a);
+    const glm::vec2 sr1 = glm::vec2(-sin_phi, cos_phi) * (0.5f / b);
+
+    const int max_x = (int)std::sqrt(a * a * cos_phi * cos_phi + b * b * sin_phi * sin_phi);
+    const int max_y = (int)std::sqrt(a * a * sin_phi * sin_phi + b * b * cos_phi * cos_phi);
+
+    // subsample to stay within the budget
+    int step = 1;
+    if (perPixelBudget > 0.f)
+    {
+        const float samples = (2.f * max_x + 1.f) * (2.f * max_y + 1.f);
+        step = std::max(1, (int)std::ceil(std::sqrt(samples / perPixelBudget)));
+    }
+
+    // sector rotation
+    const float c = std::cos(TWO_PI<float>() / NR_SECTORS);
+    const float s = std::sin(TWO_PI<float>() / NR_SECTORS);
+
+    // polynomial weight parameters
+    const float zeta = 2.f / m_radius;
+    const float zeroCross = 3.f / 8.f * PI<float>();
+    const float eta = (zeta + std::cos(zeroCross)) / sqr(std::sin(zeroCross));
+
+    glm::vec3 m[NR_SECTORS];
+    glm::vec3 sq[NR_SECTORS];
+    float wsum[NR_SECTORS];
+    for (int k = 0; k < NR_SECTORS; k++)
+    {
+        m[k] = glm::vec3(0.f);
+        sq[k] = glm::vec3(0.f);
+        wsum[k] = 0.f;
+    }
+
+    // the sample lattice is centered on the pixel so the sectors stay symmetric
+    const int start_x = (max_x / step) * step;
+    const int start_y = (max_y / step) * step;
+    for (int y = -start_y; y <= max_y; y += step)
+    {
+        const int row = Interior ? i + y : cv::borderInterpolate(i + y, image.rows, cv::BORDER_REFLECT);
+        const glm::vec3 * imageRow = image[row];
+        for (int x = -start_x; x <= max_x; x += step)
+        {
+            glm::vec2 v(sr0.x * x + sr0.y * y, sr1.x * x + sr1.y * y);
+            if (glm::dot(v, v) > 0.25f) continue;
+
+            const int col = Interior ? j + x : cv::borderInterpolate(j + x, image.cols, cv::BORDER_REFLECT);
+            const glm::vec3 color = imageRow[col];
+            const glm::vec3 color2 = color * color;
+
+            if (W == SECTOR_TEXTURE)
+            {
+                for (int k = 0; k < NR_SECTORS; k++)
+                {
+                    const float w = sampleWeights(m_sectorWeights, v);
+                    m[k] += w * color;
+                    sq[k] += w * color2;
+                    wsum[k] += w;
+                    v = glm::vec2(c * v.x + s * v.y, -s * v.x + c * v.y);
+                }
+            }
+            else
+            {
+                float w[NR_SECTORS];
+                float sum = 0.f;
+
+                // unit disc coordinates
+                v *= 2.f;
+                float vxx = zeta - eta * v.x * v.x;
+                float vyy = zeta - eta * v.y * v.y;
+                float z;
+                z = std::max(0.f, v.y + vxx);  w[0] = z * z; sum += w[0];
+                z = std::max(0.f, -v.x + vyy); w[2] = z * z; sum += w[2];
+                z = std::max(0.f, -v.y + vxx); w[4] = z * z; sum += w[4];
+                z = std::max(0.f, v.x + vyy);  w[6] = z * z; sum += w[6];
+
+                const glm::vec2 v45 = 0.70710678f * glm::vec2(v.x - v.y, v.x + v.y);
+                vxx = zeta - eta * v45.x * v45.x;
+                vyy = zeta - eta * v45.y * v45.y;
+                z = std::max(0.f, v45.y + vxx);  w[1] = z * z; sum += w[1];
+                z = std::max(0.f, -v45.x + vyy); w[3] = z * z; sum += w[3];
+                z = std::max(0.f, -v45.y + vxx); w[5] = z * z; sum += w[5];
+                z = std::max(0.f, v45.x + vyy);  w[7] = z * z; sum += w[7];
+
+                if (sum <= 0.f) continue;
+                const float g = std::exp(-3.125f * glm::dot(v, v)) / sum;
+                for (int k = 0; k < NR_SECTORS; k++)
+                {
+                    const float wk = w[k] * g;
+                    m[k] += wk * color;
+                    sq[k] += wk * color2;
+                    wsum[k] += wk;
+                }
+            }
+        }
+    }
+
+    glm::vec3 out(0.f);
+    float outSum = 0.f;
+    for (int k = 0; k < NR_SECTORS; k++)
+    {
+        if (wsum[k] <= 0.f) continue;
+        const glm::vec3 mean = m[k] / wsum[k];
+        const glm::vec3 var = glm::abs(sq[k] / wsum[k] - mean * mean);
+        const float sigma2 = var.x + var.y + var.z;
+        const float w = 1.f / (1.f + std::pow(255.f * sigma2, 0.5f * m_q));
+        out += w * mean;
+        outSum += w;
+    }
+
+    return (outSum > 0.f) ? out / outSum : image(i, j);
+}
+
+void AnisotropicKuwahara::filter(const cv::Mat_<glm::vec3> & image, const StructureTensorField & tensors, cv::Mat_<glm::vec3> & result) const
+{
+    myassert(image.size() == tensors.size());
+
+    result.create(image.size());
+
+    const float perPixelBudget = (m_sampleBudget > 0) ? (float)((double)m_sampleBudget / std::max(1, image.rows * image.cols)) : 0.f;
+
+    // the largest ellipse axis is 2 * radius, tiles further away from the border skip border handling
+    const int border = (int)std::ceil(2.f * m_radius) + 1;
+    const int tileSize = 64;
+    const int tilesY = (image.rows + tileSize - 1) / tileSize;
+    const int tilesX = (image.cols + tileSize - 1) / tileSize;
+    const cv::Rect interior(border, border, image.cols - 2 * border, image.rows - 2 * border);
+
+    parallel_for(0, tilesY * tilesX, [&](int t)
+    {
+        const cv::Rect tile = cv::Rect((t % tilesX) * tileSize, (t / tilesX) * tileSize, tileSize, tileSize)
+                & cv::Rect(0, 0, image.cols, image.rows);
+        const bool inside = interior.width > 0 && interior.height > 0 && (tile & interior) == tile;
+
+        for (int i = tile.y; i < tile.y + tile.height; i++)
+        {
+            for (int j = tile.x; j < tile.x + tile.width; j++)
+            {
+                const StructureTensor2x2 & tensor = tensors(i, j);
+                glm::vec3 & out = result(i, j);
+                if (m_weighting == SECTOR_TEXTURE)
+                {
+                    out = inside ? filterPixel<true, SECTOR_TEXTURE>(image, tensor, i, j, perPixelBudget)
+                                 : filterPixel<false, SECTOR_TEXTURE>(image, tensor, i, j, perPixelBudget);
+                }
+                else
+                {
+                    out = inside ? filterPixel<true, POLYNOMIAL>(image, tensor, i, j, perPixelBudget)
+                                 : filterPixel<false, POLYNOMIAL>(image, tensor, i, j, perPixelBudget);
+                }
+            }
+        }
+    });
+}
+
+} // namespace linde
@@ -2,18 +2,43 @@
 #include "../include/linde/GLContext.h"
 #include "../include/linde/Texture.h"
 #include "../include/linde/Shader.h"
+#include "../include/linde/ShaderStorageBuffer.h"
+
+#include <cstring>
 
 namespace linde
 {
 
 
+// one changed pixel for the scatter shader, std430 layout
+struct ConstraintChange
+{
+    glm::vec4   value;
+    glm::ivec2  position;
+    glm::ivec2  padding;
+};
+
 GPU_MultiGridDiffusion::GPU_MultiGridDiffusion():
     m_nSmooth(5),
     m_context(nullptr),
     m_jacobiShader(nullptr),
     m_restrictShader(nullptr),
     m_prolongationShader(nullptr),
-    m_steps(1)
+    m_steps(1),
+    m_workGroupSize(32, 32, 1),
+    m_smoothShader(nullptr),
+    m_residualShader(nullptr),
+    m_restrictResidualShader(nullptr),
+    m_prolongationAddShader(nullptr),
+    m_restrictRhsShader(nullptr),
+    m_residualBuffer(nullptr),
+    m_cycle(V_CYCLE),
+    m_nSmoothCycle(2),
+    m_maxCycles(10),
+    m_tolerance(1e-3f),
+    m_residual(0.f),
+    m_hierarchySize(0),
+    m_hierarchyBatches(0)
 {
 }
 
@@ -25,6 +50,23 @@ GPU_MultiGridDiffusion::GPU_MultiGridDiffusion(GLContext *context) :
     m_jacobiShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_jacobi.glsl");
     m_restrictShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_restriction.glsl");
     m_prolongationShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_prolongation.glsl");
+    m_smoothShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_smooth.glsl");
+    m_residualShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_residual.glsl");
+    m_restrictResidualShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_restrictResidual.glsl");
+    m_prolongationAddShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_prolongationAdd.glsl");
+    m_restrictRhsShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_restrictRhs.glsl");
+    m_scatterShader = m_context->createComputeShader("shaders/lindeLibShaders/MultiGridDiffusion_scatter.glsl");
+
+    GLuint zero = 0;
+    m_residualBuffer = m_context->createShaderStoragebufferObject();
+    m_residualBuffer->create(&zero, sizeof(GLuint));
+
+    ConstraintChange change = {glm::vec4(0.f), glm::ivec2(0), glm::ivec2(0)};
+    m_changesBuffer = m_context->createShaderStoragebufferObject();
+    m_changesBuffer->create(&change, sizeof(ConstraintChange));
+
+    // all multigrid shaders use the same local size
+    m_workGroupSize = m_jacobiShader->getWorkGroupSize();
 }
 
 GPU_MultiGridDiffusion::~GPU_MultiGridDiffusion()
@@ -44,7 +86,72 @@ uint nextPowerOf2(uint n)
     return n;
 }
 
-void GPU_MultiGridDiffusion::solve(cv::Mat_<glm::vec4> &psi_in)
+void GPU_MultiGridDiffusion::createHierarchy(int size, int batches)
+{
+    if (size == m_hierarchySize && batches == m_hierarchyBatches) return;
+
+    m_levels.clear();
+    m_pingPong.clear();
+    m_rhs.clear();
+    for (int s = size; s > 0; s /= 2)
+    {
+        for (std::vector<std::shared_ptr<Texture> > * textures : {&m_levels, &m_pingPong, &m_rhs})
+        {
+            std::shared_ptr<Texture> t = m_context->createTexture(s * batches, s, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_NEAREST, GL_NEAREST);
+            t->create(nullptr);
+            textures->push_back(t);
+        }
+    }
+    for (const std::shared_ptr<Texture> & t : m_rhs)
+    {
+        glClearTexImage(t->id(), 0, GL_RGBA, GL_FLOAT, nullptr);
+    }
+    m_hierarchySize = size;
+    m_hierarchyBatches = batches;
+    m_constraints.release();
+}
+
+void GPU_MultiGridDiffusion::reset()
+{
+    m_constraints.release();
+}
+
+// finest level without the padding
+void GPU_MultiGridDiffusion::download(cv::Mat_<glm::vec4> &psi) const
+{
+    cv::Mat_<glm::vec4> temp(m_hierarchySize, m_hierarchySize * m_hierarchyBatches);
+    cv::Mat_<glm::vec4> flipped;
+    m_levels[0]->bind();
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, temp.data);
+    m_levels[0]->unbind();
+    cv::flip(temp, flipped, 0);
+    flipped(cv::Rect(0, 0, psi.cols, psi.rows)).copyTo(psi);
+}
+
+void GPU_MultiGridDiffusion::solve(cv::Mat_<glm::vec4> &psi)
+{
+    solveSystem(psi, nullptr);
+}
+
+void GPU_MultiGridDiffusion::solve(std::vector<cv::Mat_<float> > &channels, const cv::Mat_<uchar> &constraints)
+{
+    solveSystem(channels, nullptr, constraints);
+}
+
+void GPU_MultiGridDiffusion::solvePoisson(cv::Mat_<glm::vec4> &psi, const cv::Mat_<glm::vec3> &divergence)
+{
+    myassert(psi.size() == divergence.size());
+    solveSystem(psi, &divergence);
+}
+
+void GPU_MultiGridDiffusion::solvePoisson(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > &divergence,
+                                          const cv::Mat_<uchar> &constraints)
+{
+    myassert(channels.size() == divergence.size());
+    solveSystem(channels, &divergence, constraints);
+}
+
+void GPU_MultiGridDiffusion::solveSystem(cv::Mat_<glm::vec4> &psi_in, const cv::Mat_<glm::vec3> *divergence)
 {
     // ensure power of two size and squared
     const cv::Size oSize = psi_in.size();
@@ -57,118 +164,839 @@ void GPU_MultiGridDiffusion::solve(cv::Mat_<glm::vec4> &psi_in)
     }
     psi_in.copyTo(psi(cv::Rect(0, 0, oSize.width, oSize.height)));
 
-    std::shared_ptr<Texture> m0 = m_context->createTexture(psi.cols, psi.rows, GL_RGBA32F, GL_RGBA, GL_FLOAT, GL_NEAREST, GL_NEAREST);
+    createHierarchy(sqSize.width, 1);
+    // incremental solves only continue laplace solves
+    if (divergence)
+    {
+        m_constraints.release();
+    } else
+    {
+        m_constraints = psi_in.clone();
+    }
 
     cv::Mat_<glm::vec4> tempFlip;
     cv::flip(psi, tempFlip, 0);
-    m0->create(tempFlip.data);
+    m_levels[0]->upload(tempFlip.data);
 
-    for (int steps = 0; steps < m_steps; steps++)
+    if (divergence)
     {
-        vCycle(m0);
+        // f = -divergence, flipped like the solution
+        for (int i = 0; i < sqSize.width * sqSize.height; i++)
+        {
+            tempFlip(i) = glm::vec4(0.f);
+        }
+        for (int i = 0; i < oSize.height; i++)
+        {
+            for (int j = 0; j < oSize.width; j++)
+            {
+                tempFlip(sqSize.height - 1 - i, j) = glm::vec4(-(*divergence)(i, j), 0.f);
+            }
+        }
+        m_rhs[0]->upload(tempFlip.data);
     }
-    // get result from GPU
-    m0->bind();
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, tempFlip.data);
-    m0->unbind();
-    cv::flip(tempFlip, psi, 0);
 
-    // remove borders
-    psi(cv::Rect(0, 0, oSize.width, oSize.height)).copyTo(psi_in);
+    solveHierarchy(divergence != nullptr);
+
+    // get result from GPU, remove borders
+    download(psi_in);
 }
 
+void GPU_MultiGridDiffusion::solveSystem(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > *divergence,
+                                         const cv::Mat_<uchar> &constraints)
+{
+    if (channels.empty()) return;
+    for (size_t c = 0; c < channels.size(); c++)
+    {
+        myassert(channels[c].size() == constraints.size());
+        myassert(!divergence || (*divergence)[c].size() == constraints.size());
+    }
 
+    const int rows = constraints.rows;
+    const int cols = constraints.cols;
+    const int size = (int)nextPowerOf2((uint)std::max(rows, cols));
+    const int nrChannels = (int)channels.size();
+    const int nrBatches = (nrChannels + 2) / 3;
 
-void GPU_MultiGridDiffusion::relaxation(std::shared_ptr<Texture> &m0, const int iterations) const
+    // as many batches per pass as the texture width allows
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    const int batchesPerPass = std::max(1, std::min(nrBatches, maxTextureSize / size));
+
+    for (int first = 0; first < nrBatches; first += batchesPerPass)
+    {
+        const int batches = std::min(batchesPerPass, nrBatches - first);
+        createHierarchy(size, batches);
+
+        // flipped, padding and unused channels are free zeros
+        cv::Mat_<glm::vec4> packed(size, size * batches);
+        cv::Mat_<glm::vec4> sources;
+        if (divergence) sources.create(size, size * batches);
+        parallel_for(0, size, [&](int i)
+        {
+            glm::vec4 * row = packed[size - 1 - i];
+            glm::vec4 * f = divergence ? sources[size - 1 - i] : nullptr;
+            for (int j = 0; j < size * batches; j++)
+            {
+                row[j] = glm::vec4(0.f);
+                if (f) f[j] = glm::vec4(0.f);
+            }
+            if (i >= rows) return;
+            for (int b = 0; b < batches; b++)
+            {
+                for (int j = 0; j < cols; j++)
+                {
+                    glm::vec4 & p = row[b * size + j];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        const int c = 3 * (first + b) + k;
+                        if (c >= nrChannels) break;
+                        p[k] = channels[c](i, j);
+                        if (f) f[b * size + j][k] = -(*divergence)[c](i, j);
+                    }
+                    p.a = (constraints(i, j) > 0) ? 1.f : 0.f;
+                }
+            }
+        });
+        m_levels[0]->upload(packed.data);
+        if (divergence) m_rhs[0]->upload(sources.data);
+
+        solveHierarchy(divergence != nullptr);
+
+        m_levels[0]->bind();
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, packed.data);
+        m_levels[0]->unbind();
+
+        parallel_for(0, rows, [&](int i)
+        {
+            const glm::vec4 * row = packed[size - 1 - i];
+            for (int b = 0; b < batches; b++)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    const int c = 3 * (first + b) + k;
+                    if (c >= nrChannels) break;
+                    float * out = channels[c][i];
+                    for (int j = 0; j < cols; j++)
+                    {
+                        out[j] = row[b * size + j][k];
+                    }
+                }
+            }
+        });
+    }
+
+    // the finest level no longer holds a vec4 solution
+    m_constraints.release();
+}
+
+// sources: m_rhs[0] holds the right hand side, otherwise it is cleared (laplace)
+void GPU_MultiGridDiffusion::solveHierarchy(bool sources)
 {
-    std::shared_ptr<Texture> m1 = m_context->createTexture(m0->width(), m0->height(), m0->getInternalFormat(),  m0->getFormat(),  m0->getType(), m0->getMinFilter(), m0->getMagFilter());
-    m1->create(nullptr);
+    if (!sources)
+    {
+        glClearTexImage(m_rhs[0]->id(), 0, GL_RGBA, GL_FLOAT, nullptr);
+    }
 
-    m_jacobiShader->bind(true);
-    int step;
-    for (step = 0; step < iterations; step++)
+    if (m_cycle == PUSH_PULL && !sources)
     {
-        if ((step % 2) == 0)
+        for (int steps = 0; steps < m_steps; steps++)
         {
-            m0->bindLocationUnit(0, GL_READ_ONLY);
-            m1->bindLocationUnit(1, GL_WRITE_ONLY);
-        } else
+            vCycle(0);
+        }
+    }
+    else
+    {
+        multigrid();
+    }
+}
+
+void GPU_MultiGridDiffusion::solveIncremental(cv::Mat_<glm::vec4> &psi, int cycles)
+{
+    if (m_constraints.empty() || m_constraints.size() != psi.size())
+    {
+        solve(psi);
+        return;
+    }
+
+    // constraints which were added, moved or changed their value, and released pixels. per row in parallel
+    std::vector<std::vector<ConstraintChange> > rowChanges(psi.rows);
+    parallel_for(0, psi.rows, [&](int i)
+    {
+        const glm::vec4 * current = psi[i];
+        const glm::vec4 * previous = m_constraints[i];
+        for (int j = 0; j < psi.cols; j++)
         {
-            m1->bindLocationUnit(0, GL_READ_ONLY);
-            m0->bindLocationUnit(1, GL_WRITE_ONLY);
+            const bool changed = (current[j].a > 0.f) ? (current[j] != previous[j]) : (previous[j].a > 0.f);
+            if (changed)
+            {
+                // textures are flipped
+                rowChanges[i].push_back({current[j], glm::ivec2(j, m_hierarchySize - 1 - i), glm::ivec2(0)});
+            }
         }
+    });
+    std::vector<ConstraintChange> changes;
+    for (const std::vector<ConstraintChange> & row : rowChanges)
+    {
+        changes.insert(changes.end(), row.begin(), row.end());
+    }
+    psi.copyTo(m_constraints);
 
-        glm::vec3 workSize = m_jacobiShader->getWorkGroupSize();
-        m_jacobiShader->dispatchCompute(m0->width() / workSize.x + 1, m0->height() / workSize.y + 1, 1);
-        m_jacobiShader->memoryBarrier();
-        m0->unbind();
-        m1->unbind();
+    if (!changes.empty())
+    {
+        m_changesBuffer->upload(changes.data(), (GLuint)(changes.size() * sizeof(ConstraintChange)));
+        m_scatterShader->bind(true);
+        m_levels[0]->bindLocationUnit(0, GL_READ_WRITE);
+        m_changesBuffer->bindBase(1);
+        m_scatterShader->seti("count", (int)changes.size());
+        m_scatterShader->dispatchCompute((GLuint)changes.size() / m_scatterShader->getWorkGroupSize().x + 1, 1, 1);
+        m_scatterShader->memoryBarrier();
+        m_scatterShader->bind(false);
+    }
+
+    if (m_cycle == PUSH_PULL)
+    {
+        for (int steps = 0; steps < cycles; steps++)
+        {
+            vCycle(0);
+        }
+    }
+    else
+    {
+        correctionCycles(cycles);
+    }
+
+    download(psi);
+}
+
+// one invocation per texel of target, the shader has to be bound
+void GPU_MultiGridDiffusion::dispatch(const std::shared_ptr<ComputeShader> &shader, const std::shared_ptr<Texture> &target) const
+{
+    shader->dispatchCompute(target->width() / m_workGroupSize.x + 1, target->height() / m_workGroupSize.y + 1, 1);
+    shader->memoryBarrier();
+}
+
+void GPU_MultiGridDiffusion::relaxation(size_t level, const int iterations)
+{
+    const std::shared_ptr<Texture> & m0 = m_levels[level];
+    const std::shared_ptr<Texture> & m1 = m_pingPong[level];
+
+    m_jacobiShader->bind(true);
+    for (int step = 0; step < iterations; step++)
+    {
+        const bool even = (step % 2) == 0;
+        (even ? m0 : m1)->bindLocationUnit(0, GL_READ_ONLY);
+        (even ? m1 : m0)->bindLocationUnit(1, GL_WRITE_ONLY);
+        dispatch(m_jacobiShader, m0);
     }
     m_jacobiShader->bind(false);
 
-    if ((step % 2) == 1)
+    // the result is in the partner, exchange roles instead of copying
+    if ((iterations % 2) == 1)
     {
-        m0 = m1;
+        std::swap(m_levels[level], m_pingPong[level]);
     }
 }
 
-void GPU_MultiGridDiffusion::restriction(const std::shared_ptr<Texture> &u, std::shared_ptr<Texture> &U) const
+void GPU_MultiGridDiffusion::restriction(size_t level) const
 {
     m_restrictShader->bind(true);
-    u->bindLocationUnit(0, GL_READ_ONLY);
-    U->bindLocationUnit(1, GL_WRITE_ONLY);
-    glm::vec3 workSize = m_restrictShader->getWorkGroupSize();
-    m_restrictShader->dispatchCompute(U->width() / workSize.x + 1, U->height() / workSize.y + 1, 1);
-    m_restrictShader->memoryBarrier();
+    m_levels[level]->bindLocationUnit(0, GL_READ_ONLY);
+    m_levels[level + 1]->bindLocationUnit(1, GL_WRITE_ONLY);
+    dispatch(m_restrictShader, m_levels[level + 1]);
     m_restrictShader->bind(false);
+}
 
+void GPU_MultiGridDiffusion::restrictRhs(size_t level) const
+{
+    m_restrictRhsShader->bind(true);
+    m_rhs[level]->bindLocationUnit(0, GL_READ_ONLY);
+    m_rhs[level + 1]->bindLocationUnit(1, GL_WRITE_ONLY);
+    dispatch(m_restrictRhsShader, m_rhs[level + 1]);
+    m_restrictRhsShader->bind(false);
 }
 
-void GPU_MultiGridDiffusion::prolongation(const std::shared_ptr<Texture> &U, std::shared_ptr<Texture> &u) const
-{    
+void GPU_MultiGridDiffusion::prolongation(size_t level) const
+{
     m_prolongationShader->bind(true);
-    U->bindLocationUnit(0, GL_READ_ONLY);
-    u->bindLocationUnit(1, GL_READ_WRITE);
-    glm::vec3 workSize = m_prolongationShader->getWorkGroupSize();
-    m_prolongationShader->dispatchCompute(U->width() / workSize.x + 1, U->height() / workSize.y + 1, 1);
-    m_prolongationShader->memoryBarrier();
+    m_levels[level + 1]->bindLocationUnit(0, GL_READ_ONLY);
+    m_levels[level]->bindLocationUnit(1, GL_READ_WRITE);
+    dispatch(m_prolongationShader, m_levels[level + 1]);
     m_prolongationShader->bind(false);
+}
+
+
+void GPU_MultiGridDiffusion::vCycle(size_t level)
+{
+    // the coarsest level (1x1) is not smoothed
+    if (level + 1 >= m_levels.size())
+    {
+        return;
+    }
+
+    // per tile size: the width grows with the number of batched channel groups
+    const int lvl = round(log(m_levels[level]->height()) / log(2.f));
+
+    // pre smoothings
+    relaxation(level, lvl*m_nSmooth);
+
+    // restriction
+    restriction(level);
+
+    // call recursively
+    vCycle(level + 1);
 
+    // inject solution
+    prolongation(level);
+
+    // post smoothings
+    relaxation(level, lvl*m_nSmooth);
 }
 
+// correction scheme for  n * u - sum(neighbors) = f  on the free pixels (alpha == 0), f = 0 for the membrane
+void GPU_MultiGridDiffusion::multigrid()
+{
+    const size_t nLevels = m_levels.size();
+
+    // full problem on every level: constraints are pushed down, sources are summed up
+    for (size_t level = 0; level + 1 < nLevels; level++)
+    {
+        restriction(level);
+        restrictRhs(level);
+    }
+
+    // full multigrid: solve the coarse problems first and use them as initial guess of the next finer level
+    smoothing(nLevels - 1, 4);
+    for (size_t level = nLevels - 1; level-- > 0;)
+    {
+        prolongation(level);
+        if (level > 0)
+        {
+            cycle(level);
+        }
+    }
+
+    correctionCycles(m_maxCycles);
+}
+
+// cycles on the current solution until its residual is reduced by m_tolerance
+void GPU_MultiGridDiffusion::correctionCycles(int maxCycles)
+{
+    const float initial = residual(0, true);
+    m_residual = 0.f;
+    for (int c = 0; c < maxCycles && initial > 0.f; c++)
+    {
+        cycle(0);
+        m_residual = residual(0, true) / initial;
+        if (m_residual <= m_tolerance) break;
+    }
+}
 
-void GPU_MultiGridDiffusion::vCycle(std::shared_ptr<Texture> &u) const
+void GPU_MultiGridDiffusion::cycle(size_t level)
 {
-    const int uw = u->width();
-    const int uh = u->height();
-    const int Uw = uw / 2;
-    const int Uh = uh / 2;
+    // 1x1 has no neighbors
+    if (level + 1 >= m_levels.size())
+    {
+        return;
+    }
 
-    const int lvl = round(log(uw) / log(2.f));
+    smoothing(level, m_nSmoothCycle);
 
-    //std::cout << "w: " << u->width() << " h: " << u->height() << std::endl;
+    residual(level, false);
+    restrictResidual(level);
 
-    if (Uw <= 0 || Uh <= 0)
+    const int gamma = (m_cycle == W_CYCLE) ? 2 : 1;
+    for (int g = 0; g < gamma; g++)
     {
+        cycle(level + 1);
+    }
+
+    prolongationAdd(level);
+
+    smoothing(level, m_nSmoothCycle);
+}
+
+// red-black gauss-seidel in place, no ping pong needed
+void GPU_MultiGridDiffusion::smoothing(size_t level, const int iterations) const
+{
+    m_smoothShader->bind(true);
+    m_levels[level]->bindLocationUnit(0, GL_READ_WRITE);
+    m_rhs[level]->bindLocationUnit(1, GL_READ_ONLY);
+    for (int step = 0; step < iterations; step++)
+    {
+        for (int color = 0; color < 2; color++)
+        {
+            m_smoothShader->seti("color", color);
+            dispatch(m_smoothShader, m_levels[level]);
+        }
+    }
+    m_smoothShader->bind(false);
+}
+
+// residual into the ping pong texture of the level, measure downloads its maximum norm
+float GPU_MultiGridDiffusion::residual(size_t level, bool measure) const
+{
+    if (measure)
+    {
+        GLuint zero = 0;
+        m_residualBuffer->upload(&zero, sizeof(GLuint));
+    }
+
+    m_residualShader->bind(true);
+    m_levels[level]->bindLocationUnit(0, GL_READ_ONLY);
+    m_rhs[level]->bindLocationUnit(1, GL_READ_ONLY);
+    m_pingPong[level]->bindLocationUnit(2, GL_WRITE_ONLY);
+    m_residualBuffer->bindBase(3);
+    dispatch(m_residualShader, m_levels[level]);
+    m_residualShader->bind(false);
+
+    if (!measure) return 0.f;
+
+    GLuint bits = 0;
+    m_residualBuffer->download(&bits, sizeof(GLuint));
+    float maxResidual;
+    std::memcpy(&maxResidual, &bits, sizeof(float));
+    return maxResidual;
+}
+
+void GPU_MultiGridDiffusion::restrictResidual(size_t level) const
+{
+    m_restrictResidualShader->bind(true);
+    m_pingPong[level]->bindLocationUnit(0, GL_READ_ONLY);
+    m_levels[level + 1]->bindLocationUnit(1, GL_WRITE_ONLY);
+    m_rhs[level + 1]->bindLocationUnit(2, GL_WRITE_ONLY);
+    dispatch(m_restrictResidualShader, m_levels[level + 1]);
+    m_restrictResidualShader->bind(false);
+}
+
+void GPU_MultiGridDiffusion::prolongationAdd(size_t level) const
+{
+    m_prolongationAddShader->bind(true);
+    m_levels[level + 1]->bindLocationUnit(0, GL_READ_ONLY);
+    m_levels[level]->bindLocationUnit(1, GL_READ_WRITE);
+    dispatch(m_prolongationAddShader, m_levels[level]);
+    m_prolongationAddShader->bind(false);
+}
+
+/*
+    ###################################################################################
+    ###################################################################################
+    ############################### CPU ###############################################
+    ###################################################################################
+    ###################################################################################
+    */
+
+// rows of small levels are not worth a thread
+template <class Function>
+static void forEachRow(int rows, int cols, Function func)
+{
+    if (rows * cols < 64 * 64)
+    {
+        for (int i = 0; i < rows; i++)
+        {
+            func(i);
+        }
+    } else
+    {
+        parallel_for(0, rows, func);
+    }
+}
+
+CPU_MultiGridDiffusion::CPU_MultiGridDiffusion():
+    m_nSmooth(2),
+    m_steps(10),
+    m_tolerance(1e-3f),
+    m_residual(0.f),
+    m_initialGuess(false)
+{
+}
+
+CPU_MultiGridDiffusion::~CPU_MultiGridDiffusion()
+{
+
+}
+
+static void splitChannels(const cv::Mat_<glm::vec4> &psi, std::vector<cv::Mat_<float> > &channels, cv::Mat_<uchar> &constraints)
+{
+    channels.resize(3);
+    constraints.create(psi.size());
+    for (int c = 0; c < 3; c++)
+    {
+        channels[c].create(psi.size());
+    }
+    for (int i = 0; i < psi.rows * psi.cols; i++)
+    {
+        const glm::vec4 & v = psi(i);
+        channels[0](i) = v.r;
+        channels[1](i) = v.g;
+        channels[2](i) = v.b;
+        constraints(i) = (v.a > 0.f) ? 255 : 0;
+    }
+}
+
+static void mergeChannels(const std::vector<cv::Mat_<float> > &channels, const cv::Mat_<uchar> &constraints, cv::Mat_<glm::vec4> &psi)
+{
+    for (int i = 0; i < psi.rows * psi.cols; i++)
+    {
+        glm::vec4 & v = psi(i);
+        v = glm::vec4(channels[0](i), channels[1](i), channels[2](i), constraints(i) ? v.a : 0.f);
+    }
+}
+
+void CPU_MultiGridDiffusion::solve(cv::Mat_<glm::vec4> &psi)
+{
+    std::vector<cv::Mat_<float> > channels;
+    cv::Mat_<uchar> constraints;
+    splitChannels(psi, channels, constraints);
+    solveSystem(channels, nullptr, constraints);
+    mergeChannels(channels, constraints, psi);
+}
+
+void CPU_MultiGridDiffusion::solve(std::vector<cv::Mat_<float> > &channels, const cv::Mat_<uchar> &constraints)
+{
+    solveSystem(channels, nullptr, constraints);
+}
+
+void CPU_MultiGridDiffusion::solvePoisson(cv::Mat_<glm::vec4> &psi, const cv::Mat_<glm::vec3> &divergence)
+{
+    myassert(psi.size() == divergence.size());
+
+    std::vector<cv::Mat_<float> > channels;
+    cv::Mat_<uchar> constraints;
+    splitChannels(psi, channels, constraints);
+
+    std::vector<cv::Mat_<float> > div(3);
+    for (int c = 0; c < 3; c++)
+    {
+        div[c].create(psi.size());
+    }
+    for (int i = 0; i < psi.rows * psi.cols; i++)
+    {
+        const glm::vec3 & d = divergence(i);
+        div[0](i) = d.r;
+        div[1](i) = d.g;
+        div[2](i) = d.b;
+    }
+
+    solveSystem(channels, &div, constraints);
+    mergeChannels(channels, constraints, psi);
+}
+
+void CPU_MultiGridDiffusion::solvePoisson(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > &divergence,
+                                          const cv::Mat_<uchar> &constraints)
+{
+    myassert(channels.size() == divergence.size());
+    solveSystem(channels, &divergence, constraints);
+}
+
+void CPU_MultiGridDiffusion::solveSystem(std::vector<cv::Mat_<float> > &channels, const std::vector<cv::Mat_<float> > *divergence,
+                                         const cv::Mat_<uchar> &constraints)
+{
+    m_residual = 0.f;
+    if (channels.empty() || constraints.empty()) return;
+
+    std::vector<Level> levels;
+    createHierarchy(levels, channels, divergence, constraints);
+
+    // full multigrid: solve the coarsest level, then interpolate and improve level by level
+    if (!m_initialGuess)
+    {
+        Level & coarsest = levels.back();
+        relaxation(coarsest, 4 * (coarsest.fixed.rows + coarsest.fixed.cols));
+        for (size_t l = levels.size() - 1; l-- > 0;)
+        {
+            prolongation(levels[l + 1], levels[l], false);
+            if (l > 0)
+            {
+                vCycle(levels, l);
+            }
+        }
+    }
+
+    // v-cycles on the finest level until the residual is reduced enough
+    std::vector<cv::Mat_<float> > r;
+    const float initial = residual(levels[0], r);
+    for (int step = 0; step < m_steps && initial > 0.f; step++)
+    {
+        vCycle(levels, 0);
+        m_residual = residual(levels[0], r) / initial;
+        if (m_residual <= m_tolerance) break;
+    }
+
+    for (size_t c = 0; c < channels.size(); c++)
+    {
+        levels[0].u[c].copyTo(channels[c]);
+    }
+}
+
+void CPU_MultiGridDiffusion::createHierarchy(std::vector<Level> &levels, const std::vector<cv::Mat_<float> > &channels,
+                                             const std::vector<cv::Mat_<float> > *divergence, const cv::Mat_<uchar> &constraints) const
+{
+    const size_t nChannels = channels.size();
+
+    levels.clear();
+    levels.emplace_back();
+    Level & finest = levels.back();
+    finest.fixed.create(constraints.size());
+    for (int i = 0; i < constraints.rows * constraints.cols; i++)
+    {
+        finest.fixed(i) = constraints(i) ? 1 : 0;
+    }
+    for (size_t c = 0; c < nChannels; c++)
+    {
+        finest.u.push_back(channels[c].clone());
+        finest.f.push_back(cv::Mat_<float>::zeros(constraints.size()));
+        if (divergence)
+        {
+            // n * u - sum(neighbors) = -laplace(u) = -divergence
+            const cv::Mat_<float> & d = (*divergence)[c];
+            myassert(d.size() == constraints.size());
+            for (int i = 0; i < constraints.rows * constraints.cols; i++)
+            {
+                finest.f[c](i) = -d(i);
+            }
+        }
+    }
+
+    // coarse cells are fixed if any child is fixed, they take the mean of those children
+    while (std::max(levels.back().fixed.rows, levels.back().fixed.cols) > 4)
+    {
+        levels.emplace_back();
+        const Level & fine = levels[levels.size() - 2];
+        Level & coarse = levels.back();
+
+        const int rows = fine.fixed.rows;
+        const int cols = fine.fixed.cols;
+        const int Rows = (rows + 1) / 2;
+        const int Cols = (cols + 1) / 2;
+
+        coarse.fixed.create(Rows, Cols);
+        coarse.u.resize(nChannels);
+        coarse.f.resize(nChannels);
+        for (size_t c = 0; c < nChannels; c++)
+        {
+            coarse.u[c].create(Rows, Cols);
+            coarse.f[c].create(Rows, Cols);
+        }
+
+        forEachRow(Rows, Cols, [&](int I)
+        {
+            for (int J = 0; J < Cols; J++)
+            {
+                int nChildren = 0, nFixed = 0;
+                for (int i = 2 * I; i <= std::min(2 * I + 1, rows - 1); i++)
+                {
+                    for (int j = 2 * J; j <= std::min(2 * J + 1, cols - 1); j++)
+                    {
+                        nChildren++;
+                        nFixed += fine.fixed(i, j);
+                    }
+                }
+                coarse.fixed(I, J) = (nFixed > 0) ? 1 : 0;
+
+                for (size_t c = 0; c < nChannels; c++)
+                {
+                    float value = 0.f, rhs = 0.f;
+                    for (int i = 2 * I; i <= std::min(2 * I + 1, rows - 1); i++)
+                    {
+                        for (int j = 2 * J; j <= std::min(2 * J + 1, cols - 1); j++)
+                        {
+                            if (fine.fixed(i, j)) value += fine.u[c](i, j);
+                            rhs += fine.f[c](i, j);
+                        }
+                    }
+                    coarse.u[c](I, J) = (nFixed > 0) ? value / nFixed : 0.f;
+                    coarse.f[c](I, J) = rhs * 4.f / nChildren;
+                }
+            }
+        });
+    }
+}
+
+// red-black gauss-seidel for  n * u - sum(neighbors) = f  on the free pixels, n counts the neighbors inside
+void CPU_MultiGridDiffusion::relaxation(Level &level, const int iterations) const
+{
+    const int rows = level.fixed.rows;
+    const int cols = level.fixed.cols;
+    const size_t nChannels = level.u.size();
+
+    for (int step = 0; step < iterations; step++)
+    {
+        for (int color = 0; color < 2; color++)
+        {
+            forEachRow(rows, cols, [&](int i)
+            {
+                for (int j = (i + color) & 1; j < cols; j += 2)
+                {
+                    if (level.fixed(i, j)) continue;
+
+                    const float n = (j > 0) + (j < cols - 1) + (i > 0) + (i < rows - 1);
+                    if (n == 0.f) continue;
+
+                    for (size_t c = 0; c < nChannels; c++)
+                    {
+                        const cv::Mat_<float> & u = level.u[c];
+                        float M = level.f[c](i, j);
+                        if (j > 0)          M += u(i, j - 1);
+                        if (j < cols - 1)   M += u(i, j + 1);
+                        if (i > 0)          M += u(i - 1, j);
+                        if (i < rows - 1)   M += u(i + 1, j);
+                        level.u[c](i, j) = M / n;
+                    }
+                }
+            });
+        }
+    }
+}
+
+// r = f - A u on the free pixels, returns the maximum norm
+float CPU_MultiGridDiffusion::residual(const Level &level, std::vector<cv::Mat_<float> > &r) const
+{
+    const int rows = level.fixed.rows;
+    const int cols = level.fixed.cols;
+    const size_t nChannels = level.u.size();
+
+    r.resize(nChannels);
+    for (size_t c = 0; c < nChannels; c++)
+    {
+        r[c].create(rows, cols);
+    }
+
+    std::vector<float> rowMax(rows, 0.f);
+    forEachRow(rows, cols, [&](int i)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            if (level.fixed(i, j))
+            {
+                for (size_t c = 0; c < nChannels; c++) r[c](i, j) = 0.f;
+                continue;
+            }
+
+            const float n = (j > 0) + (j < cols - 1) + (i > 0) + (i < rows - 1);
+            for (size_t c = 0; c < nChannels; c++)
+            {
+                const cv::Mat_<float> & u = level.u[c];
+                float M = level.f[c](i, j) - n * u(i, j);
+                if (j > 0)          M += u(i, j - 1);
+                if (j < cols - 1)   M += u(i, j + 1);
+                if (i > 0)          M += u(i - 1, j);
+                if (i < rows - 1)   M += u(i + 1, j);
+                r[c](i, j) = M;
+                rowMax[i] = std::max(rowMax[i], std::abs(M));
+            }
+        }
+    });
+
+    return rows > 0 ? *std::max_element(rowMax.begin(), rowMax.end()) : 0.f;
+}
+
+// coarse rhs is the sum of the children residuals (coarse cells have four times the area), correction starts at zero
+void CPU_MultiGridDiffusion::restriction(const std::vector<cv::Mat_<float> > &r, Level &coarse) const
+{
+    const int rows = r[0].rows;
+    const int cols = r[0].cols;
+    const int Rows = coarse.fixed.rows;
+    const int Cols = coarse.fixed.cols;
+
+    forEachRow(Rows, Cols, [&](int I)
+    {
+        const int i1 = std::min(2 * I + 1, rows - 1);
+        for (int J = 0; J < Cols; J++)
+        {
+            const int j1 = std::min(2 * J + 1, cols - 1);
+            const float scale = 4.f / ((i1 - 2 * I + 1) * (j1 - 2 * J + 1));
+            for (size_t c = 0; c < r.size(); c++)
+            {
+                float R = 0.f;
+                for (int i = 2 * I; i <= i1; i++)
+                {
+                    for (int j = 2 * J; j <= j1; j++)
+                    {
+                        R += r[c](i, j);
+                    }
+                }
+                coarse.f[c](I, J) = coarse.fixed(I, J) ? 0.f : R * scale;
+                coarse.u[c](I, J) = 0.f;
+            }
+        }
+    });
+}
+
+// bilinear interpolation (cell centered) into the free pixels of fine, added to or replacing the fine values
+void CPU_MultiGridDiffusion::prolongation(const Level &coarse, Level &fine, bool add) const
+{
+    const int rows = fine.fixed.rows;
+    const int cols = fine.fixed.cols;
+    const int Rows = coarse.fixed.rows;
+    const int Cols = coarse.fixed.cols;
+
+    forEachRow(rows, cols, [&](int i)
+    {
+        const int I0 = i / 2;
+        const int I1 = glm::clamp((i & 1) ? I0 + 1 : I0 - 1, 0, Rows - 1);
+        for (int j = 0; j < cols; j++)
+        {
+            if (fine.fixed(i, j)) continue;
+
+            const int J0 = j / 2;
+            const int J1 = glm::clamp((j & 1) ? J0 + 1 : J0 - 1, 0, Cols - 1);
+            for (size_t c = 0; c < fine.u.size(); c++)
+            {
+                const cv::Mat_<float> & U = coarse.u[c];
+                const float v = 0.5625f * U(I0, J0) + 0.1875f * (U(I0, J1) + U(I1, J0)) + 0.0625f * U(I1, J1);
+                fine.u[c](i, j) = add ? fine.u[c](i, j) + v : v;
+            }
+        }
+    });
+}
+
+void CPU_MultiGridDiffusion::vCycle(std::vector<Level> &levels, size_t l) const
+{
+    Level & level = levels[l];
+
+    if (l + 1 == levels.size())
+    {
+        relaxation(level, 4 * (level.fixed.rows + level.fixed.cols));
         return;
     }
 
     // pre smoothings
-    relaxation(u, lvl*m_nSmooth);
+    relaxation(level, m_nSmooth);
 
-    // restriction
-    std::shared_ptr<Texture> U = m_context->createTexture(Uw, Uh, u->getInternalFormat(),  u->getFormat(),  u->getType(), u->getMinFilter(), u->getMagFilter());
-    U->create(nullptr);
-    restriction(u, U);
+    // restriction of the residual
+    std::vector<cv::Mat_<float> > r;
+    residual(level, r);
+    restriction(r, levels[l + 1]);
 
-    // call recursively
-    vCycle(U);
+    // solve for the correction
+    vCycle(levels, l + 1);
 
-    // inject solution
-    prolongation(U, u);
+    // add correction
+    prolongation(levels[l + 1], level, true);
 
     // post smoothings
-    relaxation(u, lvl*m_nSmooth);
+    relaxation(level, m_nSmooth);
+}
+
+void guidanceDivergence(const cv::Mat_<float> &source, cv::Mat_<float> &divergence)
+{
+    const int rows = source.rows;
+    const int cols = source.cols;
+    divergence.create(source.size());
+
+    forEachRow(rows, cols, [&](int i)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            const float s = source(i, j);
+            float d = 0.f;
+            if (j > 0)          d += source(i, j - 1) - s;
+            if (j < cols - 1)   d += source(i, j + 1) - s;
+            if (i > 0)          d += source(i - 1, j) - s;
+            if (i < rows - 1)   d += source(i + 1, j) - s;
+            divergence(i, j) = d;
+        }
+    });
 }
 
 } // namespace linde
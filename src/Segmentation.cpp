@@ -512,7 +512,7 @@ int MeanShift(const cv::Mat_<glm::vec3>& img, cv::Mat_<int> & labels, const int
     // use Lab rather than L*u*v!
     // since Luv may produce noise points
     cv::Mat_<glm::vec3> result(img.size());
-    convert_image(img, result, convert_rgb2lab);
+    convert_image<color::RGB2Lab>(img, result);
 
 
     // Step One. Filtering stage of meanshift segmentation
@@ -13,6 +13,19 @@
 
 #include <fstream>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+
+#ifdef OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -285,15 +298,30 @@ StructureTensor2x2 StructureTensor2x2::fromAngle(float rad)
     */
 
 StructureTensorField::StructureTensorField(void) :
-    rows(0), cols(0)
+    rows(0), cols(0),
+    m_shared(std::make_shared<char>(0)),
+    m_innerSigma(0.f),
+    m_outerSigma(0.f),
+    m_multiScale(false),
+    m_scale(1.f),
+    m_threshold(-1.f)
 {
 }
 
-StructureTensorField::StructureTensorField(int rows, int cols)
+StructureTensorField::StructureTensorField(int rows, int cols) :
+    StructureTensorField()
 {
     create(rows, cols);
 }
 
+StructureTensorField::StructureTensorField(int rows, int cols, StructureTensor2x2 *data) :
+    StructureTensorField()
+{
+    this->rows = rows;
+    this->cols = cols;
+    m_tensors = cv::Mat_<StructureTensor2x2>(rows, cols, data);
+}
+
 
 StructureTensorField::~StructureTensorField(void)
 {
@@ -301,6 +329,7 @@ StructureTensorField::~StructureTensorField(void)
 
 void StructureTensorField::create(int rows, int cols)
 {
+    detach(false);
     this->rows = rows;
     this->cols = cols;
     m_tensors.create(rows, cols);
@@ -313,6 +342,7 @@ const StructureTensor2x2 &StructureTensorField::operator()(int i, int j) const
 
 StructureTensor2x2 &StructureTensorField::operator()(int i, int j)
 {
+    detach();
     return m_tensors.operator ()(i, j);
 }
 
@@ -323,21 +353,15 @@ const StructureTensor2x2 &StructureTensorField::operator()(int i) const
 
 StructureTensor2x2 &StructureTensorField::operator()(int i)
 {
+    detach();
     return m_tensors.operator ()(i);
 }
 
 
-// tensor is as follows: |dx2 dxy|
-//						 |dxy dy2|
-void StructureTensorField::computeStructureTensors(const cv::Mat_<glm::vec3> & image,
-                                                   const float innerSigma, const float outerSigma)
+// derivatives (sobel + inner blur) and their second order moments, shared by the single and multi scale computation
+static void secondOrderMoments(const cv::Mat_<glm::vec3> & image, const float innerSigma,
+                               cv::Mat_<float> & dx2, cv::Mat_<float> & dy2, cv::Mat_<float> & dxy)
 {
-    rows = image.rows;
-    cols = image.cols;
-
-    cv::Mat_<glm::dvec3> image_cv;
-    image.convertTo(image_cv, CV_64FC3);
-
     // compute derivation according to "Image and Video Abstraction by Coherence-Enhancing Filtering"
     // http://onlinelibrary.wiley.com/doi/10.1111/j.1467-8659.2011.01882.x/full
     cv::Mat_<glm::dvec3> dxTemp(image.size()), dyTemp(image.size());
@@ -353,7 +377,9 @@ void StructureTensorField::computeStructureTensors(const cv::Mat_<glm::vec3> & i
     }
 
     // second order tensors
-    cv::Mat_<float> dx2(dxTemp.size()), dy2(dxTemp.size()), dxy(dxTemp.size());
+    dx2.create(dxTemp.size());
+    dy2.create(dxTemp.size());
+    dxy.create(dxTemp.size());
     for (int i = 0; i < dxTemp.cols * dxTemp.rows; i++)
     {
         glm::vec2 g0(dxTemp(i).x, dyTemp(i).x);
@@ -364,6 +390,25 @@ void StructureTensorField::computeStructureTensors(const cv::Mat_<glm::vec3> & i
         dy2(i) = (g0.y * g0.y) + (g1.y * g1.y) + (g2.y * g2.y);
         dxy(i) = (g0.x * g0.y) + (g1.x * g1.y) + (g2.x * g2.y);
     }
+}
+
+// tensor is as follows: |dx2 dxy|
+//						 |dxy dy2|
+void StructureTensorField::computeStructureTensors(const cv::Mat_<glm::vec3> & image,
+                                                   const float innerSigma, const float outerSigma)
+{
+    rows = image.rows;
+    cols = image.cols;
+    m_innerSigma = innerSigma;
+    m_outerSigma = outerSigma;
+    m_multiScale = false;
+    m_scale = 1.f;
+    m_threshold = -1.f;
+    detach(false);
+
+    // second order tensors
+    cv::Mat_<float> dx2, dy2, dxy;
+    secondOrderMoments(image, innerSigma, dx2, dy2, dxy);
 
     // outer blur
     if (outerSigma > 0)
@@ -386,11 +431,113 @@ void StructureTensorField::computeStructureTensors(const cv::Mat_<glm::vec3> & i
 
 }
 
+void StructureTensorField::computeMultiScaleStructureTensors(const cv::Mat_<glm::vec3> & image, const float innerSigma,
+                                                             const float minSigma, const float maxSigma, const int numScales,
+                                                             cv::Mat_<float> * scaleMap)
+{
+    if (!(minSigma > 0.f) || !(maxSigma >= minSigma))
+    {
+        std::cerr << "StructureTensorField: multi scale tensors need 0 < minSigma <= maxSigma" << std::endl;
+        return;
+    }
+
+    rows = image.rows;
+    cols = image.cols;
+    m_innerSigma = innerSigma;
+    m_outerSigma = maxSigma;
+    m_multiScale = true;
+    m_scale = 1.f;
+    m_threshold = -1.f;
+    detach(false);
+
+    cv::Mat_<float> dx2, dy2, dxy;
+    secondOrderMoments(image, innerSigma, dx2, dy2, dxy);
+
+    m_tensors.create(rows, cols);
+    // tensor and trace normalized tensor of the previous scale, its change from the scale before and the best score
+    cv::Mat_<glm::vec3> previous(rows, cols), candidate(rows, cols);
+    cv::Mat_<float> previousChange(rows, cols), bestScore(rows, cols, std::numeric_limits<float>::max());
+    if (scaleMap) scaleMap->create(rows, cols);
+
+    const int n = std::max(1, numScales);
+    const float ratio = (n > 1) ? std::pow(maxSigma / minSigma, 1.f / (n - 1)) : 1.f;
+
+    // ties keep the smaller scale
+    auto select = [&](int i, int j, const glm::vec3 & tensor, float scale, float score)
+    {
+        if (score < bestScore(i, j))
+        {
+            bestScore(i, j) = score;
+            m_tensors(i, j).set(tensor.x, tensor.y, tensor.z);
+            if (scaleMap) (*scaleMap)(i, j) = scale;
+        }
+    };
+
+    float sigma = 0.f;
+    for (int k = 0; k < n; k++)
+    {
+        // blurring with sqrt(s_k^2 - s_k-1^2) on top of s_k-1 equals blurring with s_k
+        const float previousSigma = sigma;
+        const float nextSigma = minSigma * std::pow(ratio, (float)k);
+        const float incSigma = std::sqrt(std::max(0.f, sqr(nextSigma) - sqr(sigma)));
+        sigma = nextSigma;
+        if (incSigma > 0)
+        {
+            const int k_size = gaussKernelSizeFromSigma(incSigma);
+            cv::GaussianBlur(dx2, dx2, cv::Size(k_size, k_size), incSigma, 0.0, cv::BORDER_REFLECT);
+            cv::GaussianBlur(dy2, dy2, cv::Size(k_size, k_size), incSigma, 0.0, cv::BORDER_REFLECT);
+            cv::GaussianBlur(dxy, dxy, cv::Size(k_size, k_size), incSigma, 0.0, cv::BORDER_REFLECT);
+        }
+
+        // the maximal anisotropy is not a usable criterion: the coherence of pure noise is high for small integration
+        // windows and only falls as more samples are averaged, so it favours the smallest scales exactly where the
+        // image is noisy. instead every pixel takes the scale at which its trace normalized tensor (orientation and
+        // coherence) is most stable, i.e. changes least to its neighboring scales: noise settles at larger scales,
+        // structure is kept before neighboring structures mix in. a scale is scored once the next one is known, by
+        // the mean change to both neighbors, minSigma and maxSigma by the change to their single neighbor
+        parallel_for(0, rows, [&](int i)
+        {
+            for (int j = 0; j < cols; j++)
+            {
+                const float xx = std::isnan(dx2(i, j)) ? 0.f : dx2(i, j); // isnan check
+                const float xy = std::isnan(dxy(i, j)) ? 0.f : dxy(i, j); // isnan check
+                const float yy = std::isnan(dy2(i, j)) ? 0.f : dy2(i, j); // isnan check
+                const float trace = xx + yy;
+                const glm::vec3 normalized = (trace > 0.f) ? glm::vec3(xx, xy, yy) / trace : glm::vec3(0.f);
+
+                if (k > 0)
+                {
+                    const glm::vec3 d = normalized - previous(i, j);
+                    const float change = d.x * d.x + 2.f * d.y * d.y + d.z * d.z;
+                    const float score = (k == 1) ? change : 0.5f * (previousChange(i, j) + change);
+                    select(i, j, candidate(i, j), previousSigma, score);
+                    previousChange(i, j) = change;
+                }
+                candidate(i, j) = glm::vec3(xx, xy, yy);
+                previous(i, j) = normalized;
+            }
+        });
+    }
+
+    // the last scale only has the previous one as neighbor, a single scale is taken as is
+    parallel_for(0, rows, [&](int i)
+    {
+        for (int j = 0; j < cols; j++)
+            select(i, j, candidate(i, j), sigma, (n > 1) ? previousChange(i, j) : 0.f);
+    });
+}
+
 void StructureTensorField::computeStructureTensors(const cv::Mat_<glm::vec3> & image, const cv::Mat_<uchar> &mask,
                                                    const float innerSigma, const float outerSigma)
 {
     rows = image.rows;
     cols = image.cols;
+    m_innerSigma = innerSigma;
+    m_outerSigma = outerSigma;
+    m_multiScale = false;
+    m_scale = 1.f;
+    m_threshold = -1.f;
+    detach(false);
 
 
     cv::Mat_<glm::dvec3> image_cv;
@@ -510,6 +657,7 @@ void StructureTensorField::computeStructureTensors(const cv::Mat_<glm::vec3> & i
 
 void StructureTensorField::clear(int i, int j)
 {
+    detach();
     m_tensors(i, j).set(0.0f, 0.0f, 0.0f);
 }
 
@@ -625,6 +773,7 @@ const StructureTensor2x2 & StructureTensorField::getTensor(int i, int j) const
 
 StructureTensor2x2 & StructureTensorField::getTensor(int i)
 {
+    detach();
     return m_tensors(i);
 }
 
@@ -635,6 +784,7 @@ const StructureTensor2x2 & StructureTensorField::getTensor(int i) const
 
 StructureTensor2x2 & StructureTensorField::getTensor(int i, int j)
 {
+    detach();
     return m_tensors(i, j);
 }
 
@@ -645,6 +795,7 @@ const cv::Mat_<StructureTensor2x2> & StructureTensorField::getTensors() const
 
 cv::Mat_<StructureTensor2x2> & StructureTensorField::getTensors()
 {
+    detach();
     return m_tensors;
 }
 
@@ -673,6 +824,16 @@ bool StructureTensorField::load(const std::string & filename)
 
     if (!in.good()) return false;
 
+    char magic[4] = {0};
+    in.read(magic, 4);
+    if (in.gcount() == 4 && std::memcmp(magic, "LSTF", 4) == 0)
+    {
+        in.close();
+        return loadBinary(filename);
+    }
+    in.clear();
+    in.seekg(0);
+
     std::string l;
     std::getline(in, l);
     rows = std::stoi(l.c_str());
@@ -681,6 +842,7 @@ bool StructureTensorField::load(const std::string & filename)
 
     std::string delimiter = ";";
 
+    detach(false);
     m_tensors.create(rows, cols);
     for (StructureTensor2x2 & t : m_tensors)
     {
@@ -699,21 +861,222 @@ bool StructureTensorField::load(const std::string & filename)
     return true;
 }
 
+// header of the binary format, tensors follow directly (E, F, G per pixel, row major, little endian)
+struct TensorFieldFileHeader
+{
+    char        magic[4];   // "LSTF"
+    uint32_t    version;
+    int32_t     rows;
+    int32_t     cols;
+    uint32_t    dtype;      // 0 float32, 1 float16
+    uint32_t    reserved[3];
+};
+static_assert(sizeof(TensorFieldFileHeader) == 32, "binary tensor field header has to be 32 bytes");
+
+static const uint32_t TENSOR_FIELD_FILE_VERSION = 1;
+static const uint32_t TENSOR_FIELD_FLOAT32 = 0;
+static const uint32_t TENSOR_FIELD_FLOAT16 = 1;
+
+static bool readTensorFieldHeader(std::ifstream & in, TensorFieldFileHeader & header, const std::string & filename)
+{
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in.good() || std::memcmp(header.magic, "LSTF", 4) != 0)
+    {
+        std::cerr << "StructureTensorField: " << filename << " is no binary tensor field" << std::endl;
+        return false;
+    }
+    if (header.version > TENSOR_FIELD_FILE_VERSION || header.rows < 0 || header.cols < 0 ||
+        (header.dtype != TENSOR_FIELD_FLOAT32 && header.dtype != TENSOR_FIELD_FLOAT16))
+    {
+        std::cerr << "StructureTensorField: unsupported header in " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool StructureTensorField::saveBinary(const std::string & filename, bool float16) const
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.good()) return false;
+
+    TensorFieldFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "LSTF", 4);
+    header.version = TENSOR_FIELD_FILE_VERSION;
+    header.rows = m_tensors.rows;
+    header.cols = m_tensors.cols;
+    header.dtype = float16 ? TENSOR_FIELD_FLOAT16 : TENSOR_FIELD_FLOAT32;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<uint16_t> halfs(float16 ? m_tensors.cols * 3 : 0);
+    for (int i = 0; i < m_tensors.rows; i++)
+    {
+        const StructureTensor2x2 * row = m_tensors[i];
+        if (float16)
+        {
+            for (int j = 0; j < m_tensors.cols; j++)
+            {
+                halfs[j*3+0] = glm::packHalf1x16(row[j].E);
+                halfs[j*3+1] = glm::packHalf1x16(row[j].F);
+                halfs[j*3+2] = glm::packHalf1x16(row[j].G);
+            }
+            out.write(reinterpret_cast<const char*>(halfs.data()), halfs.size() * sizeof(uint16_t));
+        }
+        else
+        {
+            out.write(reinterpret_cast<const char*>(row), m_tensors.cols * sizeof(StructureTensor2x2));
+        }
+    }
+
+    return out.good();
+}
+
+bool StructureTensorField::loadBinary(const std::string & filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.good()) return false;
+
+    TensorFieldFileHeader header;
+    if (!readTensorFieldHeader(in, header, filename)) return false;
+
+    detach(false);
+    m_mapping.reset();
+    m_tensors.release();
+    create(header.rows, header.cols);
+    m_innerSigma = m_outerSigma = 0.f;
+    m_multiScale = false;
+    m_scale = 1.f;
+    m_threshold = -1.f;
+
+    std::vector<uint16_t> halfs(header.dtype == TENSOR_FIELD_FLOAT16 ? cols * 3 : 0);
+    for (int i = 0; i < rows && in.good(); i++)
+    {
+        StructureTensor2x2 * row = m_tensors[i];
+        if (header.dtype == TENSOR_FIELD_FLOAT16)
+        {
+            in.read(reinterpret_cast<char*>(halfs.data()), halfs.size() * sizeof(uint16_t));
+            for (int j = 0; j < cols; j++)
+            {
+                row[j].set(glm::unpackHalf1x16(halfs[j*3+0]),
+                           glm::unpackHalf1x16(halfs[j*3+1]),
+                           glm::unpackHalf1x16(halfs[j*3+2]));
+            }
+        }
+        else
+        {
+            in.read(reinterpret_cast<char*>(row), cols * sizeof(StructureTensor2x2));
+        }
+    }
+
+    if (!in.good())
+    {
+        std::cerr << "StructureTensorField: " << filename << " is truncated" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool StructureTensorField::mapBinary(const std::string & filename)
+{
+    TensorFieldFileHeader header;
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.good()) return false;
+        if (!readTensorFieldHeader(in, header, filename)) return false;
+    }
+    if (header.dtype != TENSOR_FIELD_FLOAT32)
+    {
+        // half floats have to be converted anyway
+        return loadBinary(filename);
+    }
+
+    const size_t length = sizeof(header) + size_t(header.rows) * header.cols * sizeof(StructureTensor2x2);
+    void * data = nullptr;
+
+#ifdef OS_WIN
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || size_t(fileSize.QuadPart) < length)
+    {
+        std::cerr << "StructureTensorField: " << filename << " is truncated" << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) return false;
+    data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, length);
+    CloseHandle(mapping);
+    if (data == NULL) return false;
+    std::shared_ptr<void> holder(data, [](void * p) { UnmapViewOfFile(p); });
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < length)
+    {
+        std::cerr << "StructureTensorField: " << filename << " is truncated" << std::endl;
+        close(fd);
+        return false;
+    }
+    // private mapping: writes are copy on write and never reach the file
+    data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    std::shared_ptr<void> holder(data, [length](void * p) { munmap(p, length); });
+#endif
+
+    StructureTensor2x2 * tensors = reinterpret_cast<StructureTensor2x2*>(static_cast<char*>(data) + sizeof(header));
+    detach(false);
+    m_tensors = cv::Mat_<StructureTensor2x2>(header.rows, header.cols, tensors);
+    m_mapping = holder;
+    rows = header.rows;
+    cols = header.cols;
+    m_innerSigma = m_outerSigma = 0.f;
+    m_multiScale = false;
+    m_scale = 1.f;
+    m_threshold = -1.f;
+
+    return true;
+}
+
+static_assert(sizeof(StructureTensor2x2) == 3 * sizeof(float), "tensors are accessed as flat float arrays");
+
 void StructureTensorField::normalize()
 {
+    detach();
+
+    // maximum squared magnitude per row, the root is only taken once
+    std::vector<float> rowMax(rows, 0.f);
+    parallel_for(0, rows, [&](int i)
+    {
+        const float * row = reinterpret_cast<const float*>(m_tensors[i]);
+        float maxSqr = 0.f;
+        for (int j = 0; j < 3 * cols; j += 3)
+        {
+            maxSqr = std::max(maxSqr, row[j] * row[j] + row[j + 1] * row[j + 1] + row[j + 2] * row[j + 2]);
+        }
+        rowMax[i] = maxSqr;
+    });
+
     float maxMag = 0.000001f;
-    for (int i = 0; i < rows*cols; i++)
+    for (float maxSqr : rowMax)
     {
-        maxMag = glm::max(maxMag, m_tensors(i).getMagnitude());
+        maxMag = glm::max(maxMag, std::sqrt(maxSqr));
     }
-    float m = 1.f / maxMag;
-    for (int i = 0; i < rows*cols; i++)
+    const float m = 1.f / maxMag;
+    m_scale *= m;
+
+    // E, F and G are scaled alike, so each row is one flat float array
+    parallel_for(0, rows, [&](int i)
     {
-        StructureTensor2x2 &tensor = m_tensors(i);
-        tensor.E *= m;
-        tensor.F *= m;
-        tensor.G *= m;
-    }
+        float * row = reinterpret_cast<float*>(m_tensors[i]);
+        for (int j = 0; j < 3 * cols; j++)
+        {
+            row[j] *= m;
+        }
+    });
 }
 
 StructureTensorField StructureTensorField::clone() const
@@ -722,67 +1085,224 @@ StructureTensorField StructureTensorField::clone() const
 
     clone.rows = rows;
     clone.cols = cols;
-    clone.m_tensors.create(rows, cols);
-    for (int i = 0; i < rows; ++i)
+    clone.m_innerSigma = m_innerSigma;
+    clone.m_outerSigma = m_outerSigma;
+    clone.m_multiScale = m_multiScale;
+    clone.m_scale = m_scale;
+    clone.m_threshold = m_threshold;
+    clone.m_tensors = m_tensors.clone();
+
+    return clone;
+}
+
+StructureTensorField StructureTensorField::snapshot() const
+{
+    // the copy shares m_tensors and the token, nothing of this field is written
+    return *this;
+}
+
+void StructureTensorField::unshare(bool keepContent)
+{
+    if (m_shared.use_count() > 1)
     {
-        for (int j = 0; j < cols; ++j)
+        if (keepContent)
+        {
+            m_tensors = m_tensors.clone();
+        }
+        else
         {
-            const StructureTensor2x2 & t = m_tensors(i, j);
-            clone.m_tensors(i, j) = t;
+            m_tensors.release();
         }
+        m_mapping.reset();
     }
-
-    return clone;
+    // new token for the now private tensors (also replaces the empty token of a moved-from field)
+    m_shared = std::make_shared<char>(0);
 }
 
 void StructureTensorField::interpolate(float minValidGradient, GLContext* gl)
 {
-    cv::Mat_<glm::vec4> psi(rows, cols);
-    cv::Mat_<uchar> m(rows, cols);
+    cv::Mat_<uchar> constraints(rows, cols);
     for (int i = 0; i < rows*cols; i++)
     {
-        const StructureTensor2x2 &tensor = m_tensors(i);
-        glm::vec4 &a = psi(i);
+        constraints(i) = (m_tensors(i).getMagnitude() <= minValidGradient) ? 0 : 255;
+    }
+
+    interpolate(cv::Rect(0, 0, cols, rows), constraints, gl);
 
-        if (tensor.getMagnitude() <= minValidGradient)
+    m_threshold = minValidGradient;
+}
+
+void StructureTensorField::interpolate(const cv::Rect & roi, const cv::Mat_<uchar> & constraints, GLContext *gl)
+{
+    detach();
+    cv::Mat_<glm::vec4> psi(roi.size());
+    for (int i = 0; i < roi.height; i++)
+    {
+        for (int j = 0; j < roi.width; j++)
         {
-            a.x = a.y = a.z = a.w = 0.f;
-            m(i) = 0;
-        } else
+            const StructureTensor2x2 &tensor = m_tensors(roi.y + i, roi.x + j);
+            glm::vec4 &a = psi(i, j);
+
+            if (constraints(i, j))
+            {
+                a.x = tensor.E;
+                a.y = tensor.F;
+                a.z = tensor.G;
+                a.w = 1.f;
+            } else
+            {
+                a.x = a.y = a.z = a.w = 0.f;
+            }
+        }
+    }
+
+    if (gl)
+    {
+        GPU_MultiGridDiffusion diffusion(gl);
+        diffusion.solve(psi);
+    } else
+    {
+        CPU_MultiGridDiffusion diffusion;
+        diffusion.solve(psi);
+    }
+
+    for (int i = 0; i < roi.height; i++)
+    {
+        for (int j = 0; j < roi.width; j++)
         {
-            glm::vec4 &a = psi(i);
-            a.x = tensor.E;
-            a.y = tensor.F;
-            a.z = tensor.G;
-            a.w = 1.f;
-            m(i) = 255;
+            if (!constraints(i, j))
+            {
+                StructureTensor2x2 &tensor = m_tensors(roi.y + i, roi.x + j);
+                const glm::vec4 &a = psi(i, j);
+                tensor.E = a.x;
+                tensor.F = a.y;
+                tensor.G = a.z;
+            }
         }
     }
+}
+
+static inline cv::Rect expandRect(const cv::Rect & r, int border)
+{
+    return cv::Rect(r.x - border, r.y - border, r.width + 2 * border, r.height + 2 * border);
+}
 
-    //    cv::imshow("interpol mask", m);
-    //    cv::imshow("input", psi);
+int StructureTensorField::supportRadius(float innerSigma, float outerSigma)
+{
+    int radius = 1; // sobel
+    if (innerSigma > 0)
+    {
+        radius += gaussKernelRadiusFromSigma(innerSigma);
+    }
+    if (outerSigma > 0)
+    {
+        radius += gaussKernelRadiusFromSigma(outerSigma);
+    }
+    return radius;
+}
 
-    GPU_MultiGridDiffusion diffusion(gl);
-    diffusion.solve(psi);
+void StructureTensorField::computeRegion(const cv::Mat_<glm::vec3> &window, const cv::Mat_<uchar> &mask, const cv::Rect &windowRect,
+                                         const cv::Rect &target, float scale)
+{
+    detach();
+    StructureTensorField local;
+    local.computeStructureTensors(window, mask, m_innerSigma, m_outerSigma);
 
-    for (int i = 0; i < rows*cols; i++)
+    const cv::Point offset = target.tl() - windowRect.tl();
+    for (int i = 0; i < target.height; i++)
     {
-        StructureTensor2x2 &tensor = m_tensors(i);
-        const glm::vec4 &a = psi(i);
+        for (int j = 0; j < target.width; j++)
+        {
+            StructureTensor2x2 &tensor = m_tensors(target.y + i, target.x + j);
+            tensor = local(offset.y + i, offset.x + j);
+            if (scale != 1.f)
+            {
+                tensor *= scale;
+            }
+        }
+    }
+}
 
-        if (tensor.getMagnitude() <= minValidGradient)
+// a tile is exact if its window is grown by the support radius, the blurs reflect at the image border
+// exactly like the in-memory path because windows touching the border end there too
+void StructureTensorField::computeStructureTensorsTiled(const std::function<cv::Mat_<glm::vec3>(const cv::Rect &)> &source, const cv::Size &imageSize,
+                                                        const float innerSigma, const float outerSigma, const int tileSize)
+{
+    rows = imageSize.height;
+    cols = imageSize.width;
+    m_innerSigma = innerSigma;
+    m_outerSigma = outerSigma;
+    m_multiScale = false;
+    m_scale = 1.f;
+    m_threshold = -1.f;
+    detach(false);
+    m_tensors.create(rows, cols);
+
+    const cv::Rect imageRect(0, 0, cols, rows);
+    const int support = supportRadius(innerSigma, outerSigma);
+    const int size = std::max(tileSize, 1);
+
+    for (int y = 0; y < rows; y += size)
+    {
+        for (int x = 0; x < cols; x += size)
         {
-            tensor.E = a.x;
-            tensor.F = a.y;
-            tensor.G = a.z;
+            const cv::Rect tile = cv::Rect(x, y, size, size) & imageRect;
+            const cv::Rect window = expandRect(tile, support) & imageRect;
+
+            computeRegion(source(window), cv::Mat_<uchar>(), window, tile, 1.f);
         }
     }
+}
+
+void StructureTensorField::computeStructureTensorsTiled(const cv::Mat_<glm::vec3> &image, const float innerSigma, const float outerSigma, const int tileSize)
+{
+    computeStructureTensorsTiled([&image](const cv::Rect & r) { return image(r); },
+                                 image.size(), innerSigma, outerSigma, tileSize);
+}
+
+void StructureTensorField::recompute(const cv::Mat_<glm::vec3> &image, const cv::Rect &dirty, GLContext *gl)
+{
+    recompute(image, cv::Mat_<uchar>(), dirty, gl);
+}
+
+void StructureTensorField::recompute(const cv::Mat_<glm::vec3> &image, const cv::Mat_<uchar> &mask, const cv::Rect &dirty, GLContext *gl)
+{
+    myassert(image.rows == rows && image.cols == cols);
+    if (m_multiScale)
+    {
+        std::cerr << "StructureTensorField: recompute is not supported for multi scale fields" << std::endl;
+        return;
+    }
+
+    const cv::Rect imageRect(0, 0, cols, rows);
+    const int support = supportRadius(m_innerSigma, m_outerSigma);
+
+    // tensors depending on the edited pixels and the pixels those depend on
+    const cv::Rect affected = expandRect(dirty, support) & imageRect;
+    if (affected.area() <= 0) return;
+    const cv::Rect window = expandRect(affected, support) & imageRect;
+
+    computeRegion(image(window), mask.data ? mask(window) : mask, window, affected, m_scale);
 
-    //    cv::imshow("Solved", m_tensors);
-    //    cv::waitKey(0);
+    if (m_threshold < 0.f) return;
+
+    // refill holes inside the affected region, the surrounding tensors act as boundary
+    const cv::Rect solveRect = expandRect(affected, 1) & imageRect;
+    cv::Mat_<uchar> constraints(solveRect.size());
+    for (int i = 0; i < solveRect.height; i++)
+    {
+        for (int j = 0; j < solveRect.width; j++)
+        {
+            const cv::Point p(solveRect.x + j, solveRect.y + i);
+            const bool hole = affected.contains(p) && m_tensors(p.y, p.x).getMagnitude() <= m_threshold;
+            constraints(i, j) = hole ? 0 : 255;
+        }
+    }
+    interpolate(solveRect, constraints, gl);
 }
 
-static inline glm::vec2 f(const StructureTensorField & field, const glm::vec2 & y, bool normalize)
+template <class Field>
+static inline glm::vec2 f(const Field & field, const glm::vec2 & y, bool normalize)
 {
     glm::vec2 v = field.getMinEigenvector(y);
     return (normalize) ? glm::normalize(v) : v;
@@ -801,7 +1321,8 @@ void StructureTensorField::RungeKutta4_MinEigenvector(const StructureTensorField
     dir = (h / 6.f) * (k1 + 2.f * k2 + 2.f * k3 + k4);
 }
 
-static inline glm::vec2 F(const StructureTensorField & field, const glm::vec2 & y, bool normalize)
+template <class Field>
+static inline glm::vec2 F(const Field & field, const glm::vec2 & y, bool normalize)
 {
 	glm::vec2 v = field.getMaxEigenvector(y);
 	return (normalize) ? glm::normalize(v) : v;
@@ -821,6 +1342,32 @@ void StructureTensorField::RungeKutta4_MaxEigenvector(const StructureTensorField
 }
 
 
+void CompactStructureTensorField::RungeKutta4_MinEigenvector(const CompactStructureTensorField & field, const glm::vec2 & pos, glm::vec2 & dir, float h, bool normalize)
+{
+    glm::vec2 k1, k2, k3, k4;
+    glm::vec2 y0 = pos;
+
+    k1 = h * f(field, y0, normalize);
+    k2 = h * f(field, y0 + k1 * 0.5f, normalize);
+    k3 = h * f(field, y0 + k2 * 0.5f, normalize);
+    k4 = h * f(field, y0 + k3, normalize);
+
+    dir = (h / 6.f) * (k1 + 2.f * k2 + 2.f * k3 + k4);
+}
+
+void CompactStructureTensorField::RungeKutta4_MaxEigenvector(const CompactStructureTensorField & field, const glm::vec2 & pos, glm::vec2 & dir, float h, bool normalize)
+{
+    glm::vec2 k1, k2, k3, k4;
+    glm::vec2 y0 = pos;
+
+    k1 = h * F(field, y0, normalize);
+    k2 = h * F(field, y0 + k1 * 0.5f, normalize);
+    k3 = h * F(field, y0 + k2 * 0.5f, normalize);
+    k4 = h * F(field, y0 + k3, normalize);
+
+    dir = (h / 6.f) * (k1 + 2.f * k2 + 2.f * k3 + k4);
+}
+
 // interpolates values!!!! leq threshold
 StructureTensorField StructureTensorField::computeStructureTensorField(GLContext* gl, const cv::Mat_<glm::vec3> & input_image, float inner_sigma, float outer_sigma, float threshold)
 {
@@ -866,4 +1413,428 @@ StructureTensorField StructureTensorField::createFixedStructureTensorField(const
 
 
 
+/*
+    ###################################################################################
+    ###################################################################################
+    ######################## Temporal Tensor Field ####################################
+    ###################################################################################
+    ###################################################################################
+    */
+
+TemporalStructureTensorField::TemporalStructureTensorField(float innerSigma, float outerSigma, float threshold,
+                                                           float alpha, float changeThreshold, int tileSize) :
+    m_innerSigma(innerSigma),
+    m_outerSigma(outerSigma),
+    m_threshold(threshold),
+    m_alpha(alpha),
+    m_changeThreshold(changeThreshold),
+    m_tileSize(std::max(8, tileSize)),
+    m_recomputedTiles(0),
+    m_solverContext(nullptr)
+{
+}
+
+void TemporalStructureTensorField::reset()
+{
+    m_current = StructureTensorField();
+    m_field = StructureTensorField();
+    m_reference.release();
+    m_blending.release();
+    m_holes.release();
+    if (m_solver) m_solver->reset();
+    m_recomputedTiles = 0;
+}
+
+void TemporalStructureTensorField::fillHoles(const std::vector<cv::Rect> & regions, GLContext *gl, bool warmStart)
+{
+    if (m_threshold < 0.f) return;
+
+    const cv::Rect imageRect(0, 0, m_current.cols, m_current.rows);
+    cv::Mat_<StructureTensor2x2> & tensors = m_current.getTensors();
+
+    // hole texels carry the current tensors, the previous interpolation where they were not recomputed
+    auto gather = [&](const cv::Rect & rect, cv::Mat_<glm::vec4> & psi)
+    {
+        psi.create(rect.size());
+        parallel_for(0, rect.height, [&](int i)
+        {
+            for (int j = 0; j < rect.width; j++)
+            {
+                const StructureTensor2x2 & t = tensors(rect.y + i, rect.x + j);
+                psi(i, j) = glm::vec4(t.E, t.F, t.G, m_holes(rect.y + i, rect.x + j) ? 0.f : 1.f);
+            }
+        });
+    };
+
+    // write back the holes per tile, tiles whose holes moved have to be blended again
+    auto scatter = [&](const cv::Rect & rect, const cv::Mat_<glm::vec4> & psi)
+    {
+        const int tx0 = rect.x / m_tileSize;
+        const int ty0 = rect.y / m_tileSize;
+        const int tilesX = (rect.br().x - 1) / m_tileSize - tx0 + 1;
+        const int tilesY = (rect.br().y - 1) / m_tileSize - ty0 + 1;
+        parallel_for(0, tilesY * tilesX, [&](int t)
+        {
+            const int ty = ty0 + t / tilesX;
+            const int tx = tx0 + t % tilesX;
+            const cv::Rect r = cv::Rect(tx * m_tileSize, ty * m_tileSize, m_tileSize, m_tileSize) & rect;
+            bool moved = false;
+            for (int y = r.y; y < r.y + r.height; y++)
+            {
+                for (int x = r.x; x < r.x + r.width; x++)
+                {
+                    if (!m_holes(y, x)) continue;
+
+                    StructureTensor2x2 & tensor = tensors(y, x);
+                    const glm::vec4 & a = psi(y - rect.y, x - rect.x);
+                    moved = moved || std::abs(a.x - tensor.E) + std::abs(a.y - tensor.F) + std::abs(a.z - tensor.G) > 1e-6f;
+                    tensor.E = a.x;
+                    tensor.F = a.y;
+                    tensor.G = a.z;
+                }
+            }
+            if (moved) m_blending(ty, tx) = 1;
+        });
+    };
+
+    cv::Mat_<glm::vec4> psi;
+    if (gl)
+    {
+        // the gpu solver keeps the last solution, so it always solves the whole frame. only changed constraints are
+        // uploaded, the previous frame's solution is the initial guess
+        if (!m_solver || m_solverContext != gl)
+        {
+            m_solver = std::make_shared<GPU_MultiGridDiffusion>(gl);
+            m_solverContext = gl;
+        }
+        gather(imageRect, psi);
+        m_solver->solveIncremental(psi);
+        scatter(imageRect, psi);
+        return;
+    }
+
+    // every region is solved on its own with one pixel around it. holes on that ring keep their previous
+    // interpolation as dirichlet values, and the holes inside start from it
+    CPU_MultiGridDiffusion diffusion;
+    diffusion.setInitialGuess(warmStart);
+    for (const cv::Rect & region : regions)
+    {
+        const cv::Rect rect = expandRect(region, 1) & imageRect;
+        gather(rect, psi);
+        for (int i = 0; i < rect.height; i++)
+        {
+            for (int j = 0; j < rect.width; j++)
+            {
+                if (!region.contains(cv::Point(rect.x + j, rect.y + i))) psi(i, j).a = 1.f;
+            }
+        }
+        diffusion.solve(psi);
+        scatter(rect, psi);
+    }
+}
+
+const StructureTensorField & TemporalStructureTensorField::update(const cv::Mat_<glm::vec3> & frame, GLContext *gl)
+{
+    const int tilesY = (frame.rows + m_tileSize - 1) / m_tileSize;
+    const int tilesX = (frame.cols + m_tileSize - 1) / m_tileSize;
+    const cv::Rect imageRect(0, 0, frame.cols, frame.rows);
+
+    // holes are the tensors at or below the threshold, they are refilled by diffusion
+    auto markHoles = [&](const cv::Rect & r)
+    {
+        const cv::Mat_<StructureTensor2x2> & tensors = m_current.m_tensors;
+        parallel_for(r.y, r.y + r.height, [&](int i)
+        {
+            for (int j = r.x; j < r.x + r.width; j++)
+            {
+                m_holes(i, j) = (m_threshold >= 0.f && tensors(i, j).getMagnitude() <= m_threshold) ? 1 : 0;
+            }
+        });
+    };
+
+    if (m_reference.size() != frame.size())
+    {
+        m_current.computeStructureTensors(frame, m_innerSigma, m_outerSigma);
+        m_current.normalize();
+        m_holes.create(frame.size());
+        markHoles(imageRect);
+        m_blending = cv::Mat_<uchar>::zeros(tilesY, tilesX);
+        if (m_solver) m_solver->reset();
+        fillHoles(std::vector<cv::Rect>(1, imageRect), gl, false);
+        m_blending.setTo(0);
+
+        m_field = m_current.clone();
+        m_reference = frame.clone();
+        m_recomputedTiles = tilesY * tilesX;
+        return m_field;
+    }
+
+    auto tileRect = [&](int ty, int tx)
+    {
+        return cv::Rect(tx * m_tileSize, ty * m_tileSize, m_tileSize, m_tileSize) & imageRect;
+    };
+
+    // mean absolute difference of each tile to the content it was computed from
+    cv::Mat_<uchar> changed(tilesY, tilesX);
+    parallel_for(0, tilesY * tilesX, [&](int t)
+    {
+        const cv::Rect r = tileRect(t / tilesX, t % tilesX);
+        float diff = 0.f;
+        for (int i = r.y; i < r.y + r.height; i++)
+        {
+            for (int j = r.x; j < r.x + r.width; j++)
+            {
+                const glm::vec3 d = glm::abs(frame(i, j) - m_reference(i, j));
+                diff += d.x + d.y + d.z;
+            }
+        }
+        changed(t / tilesX, t % tilesX) = (diff / (3.f * r.area()) > m_changeThreshold) ? 1 : 0;
+    });
+
+    // recompute runs of changed tiles, tensors around them depend on the new pixels as well.
+    // the holes of all runs are refilled afterwards
+    const int support = StructureTensorField::supportRadius(m_innerSigma, m_outerSigma);
+    std::vector<cv::Rect> regions;
+    m_recomputedTiles = 0;
+    for (int ty = 0; ty < tilesY; ty++)
+    {
+        for (int tx = 0; tx < tilesX; tx++)
+        {
+            if (!changed(ty, tx)) continue;
+
+            int end = tx;
+            while (end + 1 < tilesX && changed(ty, end + 1)) end++;
+
+            const cv::Rect dirty = tileRect(ty, tx) | tileRect(ty, end);
+            const cv::Rect affected = expandRect(dirty, support) & imageRect;
+            const cv::Rect window = expandRect(affected, support) & imageRect;
+            m_current.computeRegion(frame(window), cv::Mat_<uchar>(), window, affected, m_current.m_scale);
+            markHoles(affected);
+            regions.push_back(affected);
+
+            frame(dirty).copyTo(m_reference(dirty));
+            m_recomputedTiles += end - tx + 1;
+
+            for (int by = affected.y / m_tileSize; by <= (affected.br().y - 1) / m_tileSize; by++)
+            {
+                for (int bx = affected.x / m_tileSize; bx <= (affected.br().x - 1) / m_tileSize; bx++)
+                {
+                    m_blending(by, bx) = 1;
+                }
+            }
+            tx = end;
+        }
+    }
+
+    // overlapping regions (e.g. runs in neighboring tile rows) are solved together
+    for (bool merged = true; merged;)
+    {
+        merged = false;
+        for (size_t r = 0; r < regions.size() && !merged; r++)
+        {
+            for (size_t q = r + 1; q < regions.size() && !merged; q++)
+            {
+                if ((regions[r] & regions[q]).area() == 0) continue;
+
+                regions[r] |= regions[q];
+                regions.erase(regions.begin() + q);
+                merged = true;
+            }
+        }
+    }
+    if (!regions.empty())
+    {
+        fillHoles(regions, gl, true);
+    }
+
+    // exponential smoothing of the tiles which differ from the current tensors
+    const cv::Mat_<StructureTensor2x2> & current = m_current.getTensors();
+    cv::Mat_<StructureTensor2x2> & field = m_field.getTensors();
+    parallel_for(0, tilesY * tilesX, [&](int t)
+    {
+        uchar & blending = m_blending(t / tilesX, t % tilesX);
+        if (!blending) return;
+
+        const cv::Rect r = tileRect(t / tilesX, t % tilesX);
+        float maxDiff = 0.f;
+        for (int i = r.y; i < r.y + r.height; i++)
+        {
+            for (int j = r.x; j < r.x + r.width; j++)
+            {
+                StructureTensor2x2 & out = field(i, j);
+                out = m_alpha * current(i, j) + (1.f - m_alpha) * out;
+                const StructureTensor2x2 & c = current(i, j);
+                maxDiff = std::max(maxDiff, std::abs(out.E - c.E) + std::abs(out.F - c.F) + std::abs(out.G - c.G));
+            }
+        }
+        // converged, snap to the current tensors and skip the tile from now on
+        if (maxDiff < 1e-4f)
+        {
+            for (int i = r.y; i < r.y + r.height; i++)
+            {
+                for (int j = r.x; j < r.x + r.width; j++)
+                {
+                    field(i, j) = current(i, j);
+                }
+            }
+            blending = 0;
+        }
+    });
+
+    return m_field;
+}
+
+/*
+    ###################################################################################
+    ###################################################################################
+    ######################## Compact Tensor Field #####################################
+    ###################################################################################
+    ###################################################################################
+    */
+
+static inline float readQuantized(const cv::Mat & m, int i, int j)
+{
+    return (m.depth() == CV_16U) ? m.at<ushort>(i, j) / 65535.f : m.at<uchar>(i, j) / 255.f;
+}
+
+static inline void writeQuantized(cv::Mat & m, int i, int j, float v)
+{
+    v = glm::clamp(v, 0.f, 1.f);
+    if (m.depth() == CV_16U)
+    {
+        m.at<ushort>(i, j) = (ushort)(v * 65535.f + 0.5f);
+    }
+    else
+    {
+        m.at<uchar>(i, j) = (uchar)(v * 255.f + 0.5f);
+    }
+}
+
+CompactStructureTensorField::CompactStructureTensorField(void) :
+    rows(0), cols(0),
+    m_precision(HIGH),
+    m_maxTrace(0.f)
+{
+}
+
+CompactStructureTensorField::CompactStructureTensorField(const StructureTensorField & field, Precision precision) :
+    CompactStructureTensorField()
+{
+    encode(field, precision);
+}
+
+void CompactStructureTensorField::encode(const StructureTensorField & field, Precision precision)
+{
+    const cv::Mat_<StructureTensor2x2> & tensors = field.getTensors();
+
+    rows = tensors.rows;
+    cols = tensors.cols;
+    m_precision = precision;
+
+    const int depth = (precision == HIGH) ? CV_16U : CV_8U;
+    m_orientation.create(rows, cols);
+    m_anisotropy.create(rows, cols, depth);
+    m_trace.create(rows, cols, depth);
+
+    m_maxTrace = 0.f;
+    for (const StructureTensor2x2 & t : tensors)
+    {
+        m_maxTrace = glm::max(m_maxTrace, t.E + t.G);
+    }
+    const float invMaxTrace = (m_maxTrace > 0.f) ? 1.f / m_maxTrace : 0.f;
+
+    parallel_for(0, rows, [&](int i)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            const StructureTensor2x2 & t = tensors(i, j);
+            const float trace = glm::max(t.E + t.G, 0.f);
+            const float d = sqrt(sqr(t.E - t.G) + 4.f * sqr(t.F));
+
+            // 2 * phi in [-pi, pi]
+            const float twoPhi = atan2(2.f * t.F, t.E - t.G);
+            m_orientation(i, j) = (ushort)(((int)glm::round((twoPhi + PI<float>()) / (2.f * PI<float>()) * 65536.f)) & 0xffff);
+
+            writeQuantized(m_anisotropy, i, j, (trace > 0.f) ? d / trace : 0.f);
+            writeQuantized(m_trace, i, j, sqrt(trace * invMaxTrace));
+        }
+    });
+}
+
+StructureTensorField CompactStructureTensorField::decode() const
+{
+    StructureTensorField field(rows, cols);
+    parallel_for(0, rows, [&](int i)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            field(i, j) = getTensor(i, j);
+        }
+    });
+    return field;
+}
+
+StructureTensor2x2 CompactStructureTensorField::getTensor(int i, int j) const
+{
+    const float twoPhi = m_orientation(i, j) * (2.f * PI<float>() / 65536.f) - PI<float>();
+    const float s = readQuantized(m_trace, i, j);
+    const float trace = s * s * m_maxTrace;
+    const float d = readQuantized(m_anisotropy, i, j) * trace;
+
+    // E - G = d cos(2phi), 2F = d sin(2phi)
+    const float c = 0.5f * d * cos(twoPhi);
+    return StructureTensor2x2(0.5f * trace + c, 0.5f * d * sin(twoPhi), 0.5f * trace - c);
+}
+
+StructureTensor2x2 CompactStructureTensorField::getTensor(const glm::vec2 & pos) const
+{
+    // same sampling as interpolated(), orientation can not be interpolated directly
+    int m = cv::borderInterpolate((int)pos[1], rows, cv::BORDER_REFLECT);
+    int n = cv::borderInterpolate((int)pos[0], cols, cv::BORDER_REFLECT);
+    float mf = pos[1] - m;
+    float nf = pos[0] - n;
+
+    int m1 = cv::borderInterpolate(m + 1, rows, cv::BORDER_REFLECT);
+    int n1 = cv::borderInterpolate(n + 1, cols, cv::BORDER_REFLECT);
+
+    return (1.f - nf)*(1.f - mf)*getTensor(m, n) + nf*(1.f - mf)*getTensor(m, n1)
+            + (1.f - nf)*mf*getTensor(m1, n)
+            + nf*mf*getTensor(m1, n1);
+}
+
+float CompactStructureTensorField::getMinEigenvalue(int i, int j) const
+{
+    return getTensor(i, j).getMinEigenvalue();
+}
+
+float CompactStructureTensorField::getMaxEigenvalue(int i, int j) const
+{
+    return getTensor(i, j).getMaxEigenvalue();
+}
+
+float CompactStructureTensorField::getAnisotropy(int i, int j) const
+{
+    return readQuantized(m_anisotropy, i, j);
+}
+
+glm::vec2 CompactStructureTensorField::getMinEigenvector(int i, int j) const
+{
+    return getTensor(i, j).getMinEigenvector();
+}
+
+glm::vec2 CompactStructureTensorField::getMinEigenvector(const glm::vec2 & pos) const
+{
+    return getTensor(pos).getMinEigenvector();
+}
+
+glm::vec2 CompactStructureTensorField::getMaxEigenvector(int i, int j) const
+{
+    return getTensor(i, j).getMaxEigenvector();
+}
+
+glm::vec2 CompactStructureTensorField::getMaxEigenvector(const glm::vec2 & pos) const
+{
+    return getTensor(pos).getMaxEigenvector();
+}
+
 } // namespace linde